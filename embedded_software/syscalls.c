@@ -2,74 +2,91 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <errno.h>
+#include <string.h>
+#include <sys/time.h>
+
+/* Host calls of the emulator, see emulator/include/ecall.h */
+#define SYS_close 57
+#define SYS_lseek 62
+#define SYS_read 63
+#define SYS_write 64
+#define SYS_fstat 80
+#define SYS_exit 93
+#define SYS_gettimeofday 169
+#define SYS_sbrk 1000
+#define SYS_open 1024
+
+/* DMA device registers, see emulator/include/dma.h */
+#define DMA_SRC (*(volatile unsigned int *)0x10004000)
+#define DMA_DST (*(volatile unsigned int *)0x10004004)
+#define DMA_LEN (*(volatile unsigned int *)0x10004008)
+#define DMA_MODE (*(volatile unsigned int *)0x1000400C)
+#define DMA_COPY 1
+#define DMA_FILL 2
+#define DMA_THRESHOLD 32
+
+static long host_call(long n, long arg0, long arg1, long arg2)
+{
+	register long a0 __asm("a0") = arg0;
+	register long a1 __asm("a1") = arg1;
+	register long a2 __asm("a2") = arg2;
+	register long a7 __asm("a7") = n;
+	__asm volatile("ecall" : "+r"(a0) : "r"(a1), "r"(a2), "r"(a7) : "memory");
+	return a0;
+}
+
+/* Results from -4095 to -1 are negated errno values */
+static long host_result(long result)
+{
+	if ((unsigned long)result >= (unsigned long)-4095) {
+		errno = -result;
+		return -1;
+	}
+	return result;
+}
 
 void __attribute__((noreturn)) _exit(int exit_value)
 {
-	(void)exit_value;
-	__asm volatile( "ebreak ");
+	host_call(SYS_exit, exit_value, 0, 0);
 	while (1);
 }
 
 void* __attribute__((weak)) _sbrk(ptrdiff_t incr)
 {
 	extern char *_end;        /* Symbol defined in the linker script */
-	extern char *__stack_top; /* Symbol defined in the linker script */
-	static char *heap_end = NULL;
-	char *base;
-
-	if (!heap_end)
-		heap_end = (char*)&_end;
-	base = heap_end;
 
-	if (heap_end + incr > (char*)&__stack_top) {
-		errno = ENOMEM;
-		return (void *)-1;
-	}
-	heap_end += incr;
-
-	return base;
+	/* The emulator keeps the break, starting at _end */
+	return (void *)host_result(host_call(SYS_sbrk, incr, (long)&_end, 0));
 }
 
 
 ssize_t __attribute__((weak)) _write(int fd, const void *ptr, size_t len)
 {
-	size_t i = 0;
+	/* Console: the charOut device prints the whole buffer at once */
 	if (fd == 1 || fd == 2) {
-		for (i = 0; i < len; i++)
-			*(char*)0x10000000 = ((char*)ptr)[i];
-		return i;
+		*(volatile unsigned int *)0x1000000C = (unsigned int)ptr;
+		*(volatile unsigned int *)0x10000010 = len;
+		return len;
 	}
-	errno = EBADF;
-	return -1;
+	return host_result(host_call(SYS_write, fd, (long)ptr, len));
 }
 
 
 ssize_t __attribute__((weak)) _read(int fd, void *ptr, size_t len)
 {
-	(void)fd;
-	(void)ptr;
-	(void)len;
-	errno = EBADF;
-	return -1;
+	return host_result(host_call(SYS_read, fd, (long)ptr, len));
 }
 
 
 int __attribute__((weak)) _open(const char *path, int flags, int mode)
 {
-	(void)path;
-	(void)flags;
-	(void)mode;
-	errno = ENOENT;
-	return -1;
+	return host_result(host_call(SYS_open, (long)path, flags, mode));
 }
 
 
 int __attribute__((weak)) _close(int fd)
 {
-	if ((fd >= 0) && (fd <= 2))
-		return 0;
-	errno = EBADF;
-	return -1;
+	return host_result(host_call(SYS_close, fd, 0, 0));
 }
 
 
@@ -85,27 +102,20 @@ int __attribute__((weak)) _isatty(int fd)
 
 int __attribute__((weak)) _fstat(int fd, struct stat *st)
 {
-	if (fd >= 0 && fd <= 2) {
-		st->st_dev   = 22;
-		st->st_ino   = 7;
-		st->st_mode  = S_IFCHR | 0620;
-		st->st_nlink = 1;
-		st->st_uid   = 0;
-		st->st_gid   = 0;
-		st->st_rdev  = (dev_t)34820;
-		st->st_size  = 0;
-		st->st_blksize = 1024;
-		st->st_blocks  = 0;
-		st->st_atim.tv_sec  = 0;
-		st->st_atim.tv_nsec = 0;
-		st->st_mtim.tv_sec  = 0;
-		st->st_mtim.tv_nsec = 0;
-		st->st_ctim.tv_sec  = 0;
-		st->st_ctim.tv_nsec = 0;
-		return 0;
-	}
-	errno = EBADF;
-	return -1;
+	struct {
+		unsigned int mode;
+		unsigned int size;
+	} host_st;
+
+	if (host_result(host_call(SYS_fstat, fd, (long)&host_st, 0)) == -1)
+		return -1;
+
+	memset(st, 0, sizeof(*st));
+	st->st_mode  = host_st.mode;
+	st->st_nlink = 1;
+	st->st_size  = host_st.size;
+	st->st_blksize = 1024;
+	return 0;
 }
 
 
@@ -120,19 +130,28 @@ int __attribute__((weak)) _stat(const char *path, struct stat *st)
 
 off_t __attribute__((weak)) _lseek(int fd, off_t offset, int whence)
 {
-	(void)fd;
-	(void)offset;
-	(void)whence;
-	errno = EBADF;
-	return -1;
+	return host_result(host_call(SYS_lseek, fd, offset, whence));
 }
 
 
 int __attribute__((weak)) _gettimeofday(struct timeval *tp, void *tzp)
 {
-	(void)tp;
+	/* Microseconds of the emulator's timer, in a0 (low word) and a1 (high word) */
+	register long a0 __asm("a0");
+	register long a1 __asm("a1");
+	register long a7 __asm("a7") = SYS_gettimeofday;
+	unsigned long long us;
+
 	(void)tzp;
-	return -1;
+	if (!tp)
+		return -1;
+
+	__asm volatile("ecall" : "=r"(a0), "=r"(a1) : "r"(a7) : "memory");
+	us = (unsigned long long)(unsigned long)a1 << 32 | (unsigned long)a0;
+	tp->tv_sec = us / 1000000;
+	tp->tv_usec = us % 1000000;
+
+	return 0;
 }
 
 
@@ -153,3 +172,45 @@ int __attribute__((weak)) _link(const char *old, const char *new)
 }
 
 
+/*
+ * memcpy() and memset() above DMA_THRESHOLD bytes are done by the DMA
+ * device, in one host memmove() / memset(); shorter ones are cheaper
+ * than the four device stores.
+ */
+static void dma_start(unsigned int src, void *dst, size_t len, unsigned int mode)
+{
+	DMA_SRC = src;
+	DMA_DST = (unsigned int)dst;
+	DMA_LEN = len;
+	/* The device reads and writes RAM behind the compiler's back */
+	__asm volatile("" ::: "memory");
+	DMA_MODE = mode;
+	__asm volatile("" ::: "memory");
+}
+
+void * __attribute__((optimize("no-tree-loop-distribute-patterns"))) memcpy(void *dst, const void *src, size_t len)
+{
+	unsigned char *d = dst;
+	const unsigned char *s = src;
+
+	if (len >= DMA_THRESHOLD) {
+		dma_start((unsigned int)src, dst, len, DMA_COPY);
+		return dst;
+	}
+	while (len--)
+		*d++ = *s++;
+	return dst;
+}
+
+void * __attribute__((optimize("no-tree-loop-distribute-patterns"))) memset(void *dst, int c, size_t len)
+{
+	unsigned char *d = dst;
+
+	if (len >= DMA_THRESHOLD) {
+		dma_start((unsigned char)c, dst, len, DMA_FILL);
+		return dst;
+	}
+	while (len--)
+		*d++ = c;
+	return dst;
+}
@@ -40,6 +40,50 @@ FixedMul
 
 
 
+#ifdef MINIRISC_DIVL
+
+//
+// DIVL rd, rs1, rs2, rs3, rd2: rd = rs2:rs1 / rs3, rd2 = rs2:rs1 % rs3,
+// the MINIRISC 64 / 32 division (see emulator/include/types.h). The
+// assembler does not know it: the word is encoded here with fixed
+// registers, quotient in a3, dividend in a1:a0, divisor in a2,
+// remainder in a4.
+//
+
+#define DIVL_CODE 40
+#define DIVL_A3_A0_A1_A2_A4 (DIVL_CODE | 13 << 7 | 10 << 12 | 11 << 17 | 12 << 22 | 14 << 27)
+
+//
+// FixedDiv, MINIRISC version: one DIVL instead of a __divdi3 call.
+//
+
+fixed_t FixedDiv(fixed_t a, fixed_t b)
+{
+    register uint32_t low __asm("a0");
+    register int32_t high __asm("a1");
+    register int32_t divisor __asm("a2");
+    register int32_t quotient __asm("a3");
+    register int32_t remainder __asm("a4");
+
+    if ((abs(a) >> 14) >= abs(b))
+    {
+	return (a^b) < 0 ? INT_MIN : INT_MAX;
+    }
+
+    // (int64_t) a << 16, as two words
+    low = (uint32_t) a << 16;
+    high = a >> 16;
+    divisor = b;
+    __asm volatile(".word %5"
+		   : "=r"(quotient), "=r"(remainder)
+		   : "r"(low), "r"(high), "r"(divisor), "i"(DIVL_A3_A0_A1_A2_A4));
+    (void) remainder;
+
+    return quotient;
+}
+
+#else
+
 //
 // FixedDiv, C version.
 //
@@ -60,3 +104,5 @@ fixed_t FixedDiv(fixed_t a, fixed_t b)
     }
 }
 
+#endif
+
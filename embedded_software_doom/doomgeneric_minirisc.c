@@ -2,9 +2,20 @@
 #include <stdint.h>
 #include <sys/time.h>
 
+/* Framebuffer device of the emulator: the host reads the pixels in place */
+#define FB_ADDR (*(volatile uint32_t *)0x10002000)
+#define FB_WIDTH (*(volatile uint32_t *)0x10002004)
+#define FB_HEIGHT (*(volatile uint32_t *)0x10002008)
+#define FB_DOORBELL (*(volatile uint32_t *)0x1000200C)
+
+/* Timer device of the emulator */
+#define MTIMER_SLEEP (*(volatile uint32_t *)0x1000300C)
+
 int main(void)
 {
     doomgeneric_Create(0, 0);
+    /* End of the initialization: snapshot point of the emulator (vmctl marker) */
+    *(volatile uint32_t *)0x10001000 = 1;
     while (1)
     {
         doomgeneric_Tick();
@@ -18,11 +29,15 @@ void DG_Init(void)
     *(char *)0x10000000 = 'I';
     *(char *)0x10000000 = 'T';
     *(char *)0x10000000 = '\n';
+
+    FB_ADDR = (uint32_t)DG_ScreenBuffer;
+    FB_WIDTH = DOOMGENERIC_RESX;
+    FB_HEIGHT = DOOMGENERIC_RESY;
 }
 
 void DG_DrawFrame(void)
 {
-    *(char *)0x10000000 = 'D';
+    FB_DOORBELL = 1;
 
     static int frame = 0;
     if (++frame % 100 == 0)
@@ -33,11 +48,8 @@ void DG_DrawFrame(void)
 
 void DG_SleepMs(uint32_t ms)
 {
-    uint32_t start = DG_GetTicksMs();
-    while (DG_GetTicksMs() - start < ms)
-    {
-        __asm volatile("nop");
-    }
+    /* The timer advances the virtual clock, or waits on the host */
+    MTIMER_SLEEP = ms * 1000;
 }
 
 uint32_t DG_GetTicksMs(void)
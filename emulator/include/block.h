@@ -0,0 +1,69 @@
+#ifndef H_BLOCK
+#define H_BLOCK
+
+#include <inttypes.h>
+#include "minirisc.h"
+
+#define BLOCK_MAX_INSNS 64
+#define BLOCK_HASH_BITS 16
+#define BLOCK_HASH_SIZE (1 << BLOCK_HASH_BITS)
+#define BLOCK_ARENA_SIZE (32 * 1024 * 1024)
+
+struct jit_t;
+struct profile_t;
+
+/**
+ * A translated basic block: a straight-line run of decoded instructions
+ * ending with a control transfer (JAL, JALR, branch, ECALL, EBREAK)
+ * or after BLOCK_MAX_INSNS instructions.
+ */
+struct block_t
+{
+    uint32_t pc;              /* Address of the first instruction */
+    uint32_t n_insns;
+    struct block_t *hash_next;
+    uint32_t next_pc[2];      /* Successor addresses seen so far (taken / fall-through) */
+    struct block_t *next[2];  /* Chained successors, NULL until linked */
+    uint32_t exec_count;
+    uint64_t hits;            /* Entries not yet added to the profile, when profiling */
+    void (*native)(struct minirisc_t *minirisc); /* JIT translation, NULL until the block is hot */
+    struct insn_t insns[];    /* Micro-ops */
+};
+
+/**
+ * Translated blocks are bump-allocated in an arena and looked up by PC
+ * in a hash table. Any write to a page holding translated code flushes
+ * everything, which also drops all chaining links.
+ */
+struct block_cache_t
+{
+    struct block_t *hash[BLOCK_HASH_SIZE];
+    uint8_t *arena;
+    uint32_t arena_used;
+    uint32_t generation; /* Incremented on each flush */
+    int dirty; /* Set by the code write hook, the cache is flushed at the next block boundary */
+    struct jit_t *jit; /* Compiles hot blocks when the JIT engine is selected, NULL otherwise */
+    struct profile_t *profile; /* Receives the block hits on flush, NULL unless profiling */
+};
+
+/**
+ * Allocate an empty block cache.
+ */
+struct block_cache_t *block_cache_new();
+
+/**
+ * Free the block cache and all its blocks.
+ */
+void block_cache_free(struct block_cache_t *cache);
+
+/**
+ * Drop every translated block.
+ */
+void block_cache_flush(struct block_cache_t *cache);
+
+/**
+ * Run the processor with the block engine until halt is set.
+ */
+void block_run(struct minirisc_t *minirisc);
+
+#endif
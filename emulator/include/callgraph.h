@@ -0,0 +1,90 @@
+#ifndef H_CALLGRAPH
+#define H_CALLGRAPH
+
+#include <inttypes.h>
+#include "elf_loader.h"
+
+#define CALLGRAPH_NONE UINT32_MAX
+
+/**
+ * Node of the calling context tree: one function reached through one
+ * call path. Children are chained through next_sibling.
+ */
+struct callgraph_node_t
+{
+    uint32_t addr;         /* Entry address of the function */
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t next_sibling;
+    uint64_t self;         /* Instructions executed in this function on this path */
+};
+
+struct callgraph_frame_t
+{
+    uint32_t node;
+    uint32_t return_addr;
+};
+
+/**
+ * Shadow call stack and calling context tree.
+ * JAL/JALR with rd = ra are calls, JALR x0, 0(ra) is a return.
+ * Instructions are charged to the current node between two events,
+ * from the instruction count: the call instruction belongs to the
+ * caller, the return instruction to the callee.
+ */
+struct callgraph_t
+{
+    struct callgraph_node_t *nodes; /* Parents always come before their children */
+    uint32_t n_nodes;
+    uint32_t max_nodes;
+    struct callgraph_frame_t *frames;
+    uint32_t depth;
+    uint32_t max_depth;
+    uint32_t current; /* Node being executed */
+    uint64_t last;    /* Instruction count at the last event */
+};
+
+/**
+ * Start a call graph whose root is the function at entry,
+ * now being the current instruction count.
+ */
+struct callgraph_t *callgraph_new(uint32_t entry, uint64_t now);
+
+/**
+ * Free the call graph.
+ */
+void callgraph_free(struct callgraph_t *callgraph);
+
+/**
+ * A call to target that will return to return_addr.
+ * now is the instruction count including the call.
+ */
+void callgraph_call(struct callgraph_t *callgraph, uint32_t target, uint32_t return_addr, uint64_t now);
+
+/**
+ * A return to target. Frames skipped by a non-local exit (longjmp) are
+ * popped too; returns that match no frame are ignored.
+ */
+void callgraph_return(struct callgraph_t *callgraph, uint32_t target, uint64_t now);
+
+/**
+ * Charge the instructions executed since the last event, at the end of the run.
+ */
+void callgraph_finish(struct callgraph_t *callgraph, uint64_t now);
+
+/**
+ * Write one "caller;callee;... count" line per call path with exclusive
+ * counts, the folded format read by flamegraph.pl and speedscope.
+ * Functions are named from elf (may be NULL), or by address.
+ * @return 0 on success, -1 if the file could not be written
+ */
+int callgraph_write_folded(struct callgraph_t *callgraph, struct elf_t *elf, const char *file_name);
+
+/**
+ * Write the call tree, indented by depth, with the inclusive and
+ * exclusive instruction counts of every call path.
+ * @return 0 on success, -1 if the file could not be written
+ */
+int callgraph_write_tree(struct callgraph_t *callgraph, struct elf_t *elf, const char *file_name);
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef H_CHECKPOINT
+#define H_CHECKPOINT
+
+#include <inttypes.h>
+#include "minirisc.h"
+#include "ecall.h"
+
+#define CHECKPOINT_MAGIC "MRCKPT4"
+
+/**
+ * Checkpoint file: this header, the page index, the guest's open files,
+ * then the RAM pages.
+ * Pages that read as zero are not stored. Raw pages sit at page-aligned
+ * file offsets, in RAM order, so that a restore maps each run of them
+ * with a single mmap(); compressed pages are inflated into RAM.
+ */
+struct checkpoint_header_t
+{
+    char magic[8];
+    uint32_t ram_size;
+    uint32_t pc;
+    uint32_t regs[32];
+    uint64_t instret;
+    uint32_t n_pages;      /* Entries of the page index */
+    uint32_t charout_buf;  /* Console buffer register set by the guest */
+    uint64_t index_offset; /* File offset of the page index */
+    struct
+    {
+        uint32_t addr;
+        uint32_t width;
+        uint32_t height;
+        uint32_t reserved;
+    } framebuffer;         /* Device registers set by the guest */
+    uint64_t timer_slept;  /* Sleeps added to the virtual clock */
+    uint32_t brk;          /* Program break of the host call bridge */
+    uint32_t n_files;      /* Entries of the file table */
+    uint64_t files_offset; /* File offset of the file table */
+    struct
+    {
+        uint32_t src;
+        uint32_t dst;
+        uint32_t len;
+        uint32_t reserved;
+    } dma;                 /* DMA registers, the guest may be between two stores */
+    uint64_t fregs[32];    /* F / D registers */
+    uint32_t fcsr;
+    uint32_t reserved;
+};
+
+struct checkpoint_page_t
+{
+    uint32_t page;   /* Page number in RAM */
+    uint32_t size;   /* PAGE_SIZE for a raw page, zlib stream size for a compressed one */
+    uint64_t offset; /* File offset of the data */
+};
+
+/**
+ * A file the guest had open through the host call bridge, reopened on restore.
+ */
+struct checkpoint_file_t
+{
+    uint32_t fd;
+    uint32_t flags;
+    uint64_t offset;
+    char path[ECALL_PATH_MAX];
+};
+
+/**
+ * Checkpoint opened for restoring.
+ */
+struct checkpoint_t
+{
+    int fd;
+    struct checkpoint_header_t header;
+    struct checkpoint_page_t *pages;
+    struct checkpoint_file_t *files;
+};
+
+/**
+ * Write the registers, PC, instruction count, device state, open files
+ * and non-zero RAM pages of minirisc to file_name. With compress, pages that zlib shrinks to half
+ * their size or less are stored compressed.
+ * @return 0 on success, -1 if the file could not be written
+ */
+int checkpoint_write(struct minirisc_t *minirisc, const char *file_name, int compress);
+
+/**
+ * Open file_name and read its header and page index.
+ * The RAM size to give platform_new() is header.ram_size.
+ * Exits if the file is not a valid checkpoint.
+ */
+struct checkpoint_t *checkpoint_open(const char *file_name);
+
+/**
+ * Restore the checkpoint in minirisc and its platform, which must have
+ * a fresh RAM of header.ram_size bytes. Raw pages are mapped MAP_PRIVATE
+ * from the file: they are only read when the guest touches them.
+ */
+void checkpoint_load(struct checkpoint_t *checkpoint, struct minirisc_t *minirisc);
+
+/**
+ * Close the file and free the index. Mapped pages stay valid.
+ */
+void checkpoint_close(struct checkpoint_t *checkpoint);
+
+#endif
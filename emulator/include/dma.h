@@ -0,0 +1,44 @@
+#ifndef H_DMA
+#define H_DMA
+
+#include <inttypes.h>
+
+struct platform_t;
+
+/* Registers of the DMA device, at DMA_BASE */
+#define DMA_SRC 0x00  /* RW: source address, or the fill byte in its low 8 bits */
+#define DMA_DST 0x04  /* RW: destination address */
+#define DMA_LEN 0x08  /* RW: bytes to copy or fill */
+#define DMA_MODE 0x0C /* W: DMA_COPY or DMA_FILL starts the transfer, done when the store retires */
+#define DMA_SIZE 0x10
+
+#define DMA_COPY 1 /* memmove(dst, src, len): the ranges may overlap */
+#define DMA_FILL 2 /* memset(dst, src & 0xFF, len) */
+
+/**
+ * DMA copy / fill device. A transfer runs on the host as a single
+ * memmove() or memset() on guest RAM, instead of one platform access per
+ * element; both ranges must lie in RAM, the destination in writable
+ * pages, or the starting store faults.
+ */
+struct dma_t
+{
+    struct platform_t *platform;
+    uint32_t src;
+    uint32_t dst;
+    uint32_t len;
+    uint64_t transfers;
+    uint64_t bytes;
+};
+
+/**
+ * Create the device and map it at DMA_BASE.
+ */
+struct dma_t *dma_new(struct platform_t *platform);
+
+/**
+ * Free the device. Its mapping is freed with the platform.
+ */
+void dma_free(struct dma_t *dma);
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef H_ECALL
+#define H_ECALL
+
+#include <inttypes.h>
+#include "minirisc.h"
+
+/**
+ * Host calls made by the guest with ECALL: the number in a7, arguments
+ * in a0-a2, the result in a0 (a negative errno on failure). Numbers
+ * follow the RISC-V Linux ABI, except SBRK which has no Linux equivalent.
+ */
+#define ECALL_CLOSE 57         /* close(fd) */
+#define ECALL_LSEEK 62         /* lseek(fd, offset, whence) */
+#define ECALL_READ 63          /* read(fd, buf, len) */
+#define ECALL_WRITE 64         /* write(fd, buf, len) */
+#define ECALL_FSTAT 80         /* fstat(fd, struct ecall_stat_t *) */
+#define ECALL_EXIT 93          /* exit(code) */
+#define ECALL_GETTIMEOFDAY 169 /* Timer device time in microseconds, low word in a0, high word in a1 */
+#define ECALL_SBRK 1000        /* sbrk(increment, end of the program): previous break */
+#define ECALL_OPEN 1024        /* open(path, flags, mode) */
+
+/* open() flags as the guest's newlib defines them */
+#define ECALL_O_ACCMODE 0x0003
+#define ECALL_O_APPEND 0x0008
+#define ECALL_O_CREAT 0x0200
+#define ECALL_O_TRUNC 0x0400
+#define ECALL_O_EXCL 0x0800
+
+#define ECALL_MAX_FILES 16     /* Guest file descriptors, 0-2 are the console */
+#define ECALL_PATH_MAX 256
+#define ECALL_STACK_GUARD (1 << 20) /* The heap stops this far below the stack pointer */
+
+/**
+ * Result of ECALL_FSTAT, converted to a struct stat by the guest.
+ */
+struct ecall_stat_t
+{
+    uint32_t mode; /* S_IFREG, S_IFCHR... and permissions, same values on both sides */
+    uint32_t size;
+};
+
+/**
+ * A file opened by the guest. Reads and writes go through pread() and
+ * pwrite() at the guest's own offset, so forked VMs sharing the host
+ * descriptor do not move each other's position, and a checkpoint only
+ * has to keep the path, the flags and the offset.
+ */
+struct ecall_file_t
+{
+    int host_fd; /* -1 when the guest descriptor is free */
+    uint32_t flags; /* Guest flags, O_CREAT / O_TRUNC / O_EXCL dropped after the first open */
+    uint64_t offset;
+    char path[ECALL_PATH_MAX];
+};
+
+struct ecall_t
+{
+    struct minirisc_t *minirisc;
+    uint32_t brk; /* Program break, 0 until the first ECALL_SBRK sets it to the end of the program */
+    struct ecall_file_t files[ECALL_MAX_FILES];
+};
+
+/**
+ * Create the host call bridge of minirisc.
+ */
+struct ecall_t *ecall_new(struct minirisc_t *minirisc);
+
+/**
+ * Close the files still open and free the bridge.
+ */
+void ecall_free(struct ecall_t *ecall);
+
+/**
+ * Execute the host call requested by the ECALL instruction being executed.
+ */
+void ecall_dispatch(struct ecall_t *ecall);
+
+/**
+ * Reopen a file recorded in a checkpoint as guest descriptor fd.
+ * @return 0 on success, -1 if the file cannot be opened again
+ */
+int ecall_restore_file(struct ecall_t *ecall, uint32_t fd, uint32_t flags, uint64_t offset, const char *path);
+
+#endif
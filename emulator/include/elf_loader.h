@@ -0,0 +1,63 @@
+#ifndef H_ELF_LOADER
+#define H_ELF_LOADER
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "platform.h"
+
+/**
+ * Function symbol of the loaded program.
+ * name points into the mapped file.
+ */
+struct elf_symbol_t
+{
+    const char *name;
+    uint32_t addr;
+    uint32_t size;
+};
+
+/**
+ * ELF32 executable, mapped read-only for the whole run.
+ */
+struct elf_t
+{
+    int fd;
+    uint8_t *image;
+    size_t image_size;
+    uint32_t entry;
+    struct elf_symbol_t *symbols; /* Sorted by address */
+    uint32_t n_symbols;
+};
+
+/**
+ * Map file_name and parse its headers and symbol table.
+ * @return NULL if the file is not an ELF file (a raw binary).
+ *         Exits on a malformed or unsupported ELF file.
+ */
+struct elf_t *elf_open(const char *file_name);
+
+/**
+ * Unmap the file and free the symbol table.
+ */
+void elf_close(struct elf_t *elf);
+
+/**
+ * Map the PT_LOAD segments in the platform's RAM at their p_vaddr.
+ * Whole pages are mapped copy-on-write from the file and whole .bss pages
+ * are replaced by fresh zero pages, so nothing is read or cleared before
+ * the guest touches it. Only partial pages at segment edges are copied.
+ */
+void elf_load(struct elf_t *elf, struct platform_t *platform);
+
+/**
+ * Return the symbol whose [addr, addr + size) contains addr
+ * (or the closest one below addr for symbols of size 0), NULL if none.
+ */
+const struct elf_symbol_t *elf_symbol_at(struct elf_t *elf, uint32_t addr);
+
+/**
+ * Return the symbol called name, NULL if none.
+ */
+const struct elf_symbol_t *elf_symbol_by_name(struct elf_t *elf, const char *name);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef H_FPU
+#define H_FPU
+
+#include <inttypes.h>
+#include "minirisc.h"
+
+/* fcsr.fflags, accrued exception flags */
+#define FPU_NX 0x01 /* Inexact */
+#define FPU_UF 0x02 /* Underflow */
+#define FPU_OF 0x04 /* Overflow */
+#define FPU_DZ 0x08 /* Division by zero */
+#define FPU_NV 0x10 /* Invalid operation */
+#define FPU_FLAGS 0x1F
+#define FPU_FRM_SHIFT 5
+
+/* CSR numbers of FCSRRW / FCSRRS / FCSRRC, as in RISC-V */
+#define FPU_CSR_FFLAGS 1
+#define FPU_CSR_FRM 2
+#define FPU_CSR_FCSR 3
+
+/**
+ * Rounding modes of the rm field and of fcsr.frm.
+ */
+enum fpu_rm_t
+{
+    FPU_RNE = 0, /* To nearest, ties to even */
+    FPU_RTZ = 1, /* Toward zero */
+    FPU_RDN = 2, /* Down */
+    FPU_RUP = 3, /* Up */
+    FPU_RMM = 4, /* To nearest, ties away from zero */
+    FPU_DYN = 7, /* rm field only: fcsr.frm */
+};
+
+/**
+ * Decode instr into insn if it is an F / D instruction.
+ * The register fields are already set.
+ * @return 0 if instr is not a floating-point instruction
+ */
+int fpu_decode(uint32_t instr, struct insn_t *insn);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef H_FRAMEBUFFER
+#define H_FRAMEBUFFER
+
+#include <inttypes.h>
+
+struct platform_t;
+struct framebuffer_t;
+
+/* Registers of the framebuffer device, at FB_BASE */
+#define FB_ADDR 0x00     /* RW: guest address of the pixels, 32-bit 0x00RRGGBB, rows without padding */
+#define FB_WIDTH 0x04    /* RW: in pixels */
+#define FB_HEIGHT 0x08   /* RW: in pixels */
+#define FB_DOORBELL 0x0C /* W: a frame is ready in the buffer */
+#define FB_FRAMES 0x10   /* R: frames signalled so far */
+#define FB_SIZE 0x14
+
+/**
+ * Called on each doorbell, on the emulation thread. pixels is the host
+ * view of the guest buffer: it is only valid until the guest runs again.
+ */
+typedef void (*framebuffer_listener_t)(void *opaque, const struct framebuffer_t *fb, const uint32_t *pixels);
+
+/**
+ * Framebuffer device. The pixels stay in guest RAM, where the guest
+ * draws them; the host reads them in place, without going through
+ * platform_read().
+ */
+struct framebuffer_t
+{
+    struct platform_t *platform;
+    uint32_t addr;
+    uint32_t width;
+    uint32_t height;
+    uint64_t frames;
+    framebuffer_listener_t listener; /* NULL if nobody consumes the frames */
+    void *listener_opaque;
+};
+
+/**
+ * Create the device and map it at FB_BASE.
+ */
+struct framebuffer_t *framebuffer_new(struct platform_t *platform);
+
+/**
+ * Free the device. Its mapping is freed with the platform.
+ */
+void framebuffer_free(struct framebuffer_t *fb);
+
+/**
+ * Host view of the buffer currently set by the guest.
+ * @return NULL if the buffer is not configured or not entirely in RAM
+ */
+const uint32_t *framebuffer_pixels(const struct framebuffer_t *fb);
+
+/**
+ * Set the function called on each doorbell (NULL to remove it).
+ */
+void framebuffer_set_listener(struct framebuffer_t *fb, framebuffer_listener_t listener, void *opaque);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef H_HLE
+#define H_HLE
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "minirisc.h"
+#include "elf_loader.h"
+
+/**
+ * Opcode given to the decoded entry instruction of a hooked function.
+ * No MINIRISC instruction uses it: like unknown opcodes, it ends blocks
+ * and every engine runs it through its interpreter handler.
+ */
+#define HLE_CODE 0x7F
+
+#define HLE_MAX_HOOKS 16
+
+enum hle_mode_t
+{
+    HLE_NATIVE, /* Run the host routine instead of the guest function */
+    HLE_CHECK,  /* Run both and stop at the first difference; the guest results are kept */
+};
+
+/**
+ * A guest function replaced by a host routine.
+ * The routine reads its arguments in a0-a3 (64-bit values as low / high
+ * pairs, ILP32 ABI) and writes its result in a0 (a0-a1). It may decline
+ * a call it cannot reproduce exactly (range outside RAM, division by
+ * zero...): the guest function then runs.
+ */
+struct hle_hook_t
+{
+    const char *name;
+    uint32_t addr;
+    int (*native)(struct platform_t *platform, uint32_t *regs); /* -1 to decline */
+    int results;   /* Result registers compared by HLE_CHECK: 1 (a0) or 2 (a0, a1) */
+    int sign_only; /* Only the sign of a0 is specified (strcmp) */
+    int writes;    /* Writes [a0, a0 + a2), compared by HLE_CHECK */
+    uint64_t calls;
+};
+
+/**
+ * High-level emulation of hot libc / libgcc routines, found by name in
+ * the ELF symbol table. The hooks live in the decoder: the entry of a
+ * hooked function decodes to HLE_CODE and executes as one instruction
+ * returning to ra, so every engine, the instruction cache and the
+ * translated blocks see it without patching guest memory.
+ */
+struct hle_t
+{
+    struct minirisc_t *minirisc;
+    enum hle_mode_t mode;
+    struct hle_hook_t hooks[HLE_MAX_HOOKS];
+    uint32_t n_hooks;
+    uint64_t declined; /* Calls left to the guest function */
+    uint64_t checked;  /* Calls compared by HLE_CHECK */
+    int checking;      /* HLE_CHECK is running a guest function: hook entries are plain instructions */
+    uint8_t *scratch;  /* HLE_CHECK copies of the written range */
+    size_t scratch_size;
+};
+
+/**
+ * Parse "native" or "check".
+ * @return -1 if the name is unknown
+ */
+int hle_parse_mode(const char *name, enum hle_mode_t *mode);
+
+/**
+ * Hook the functions of elf that have a host routine.
+ * Must be called before the first instruction is decoded.
+ */
+struct hle_t *hle_new(struct minirisc_t *minirisc, struct elf_t *elf, enum hle_mode_t mode);
+
+void hle_free(struct hle_t *hle);
+
+/**
+ * Turn insn, just decoded at pc, into a hook entry if pc is hooked.
+ */
+void hle_decode(struct hle_t *hle, uint32_t pc, struct insn_t *insn);
+
+/**
+ * Calls handled by the host routines.
+ */
+uint64_t hle_calls(const struct hle_t *hle);
+
+#endif
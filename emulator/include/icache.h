@@ -0,0 +1,71 @@
+#ifndef H_ICACHE
+#define H_ICACHE
+
+#include <inttypes.h>
+#include "types.h"
+#include "minirisc.h"
+
+#define ICACHE_INSNS_PER_PAGE (PAGE_SIZE >> 2)
+
+/**
+ * Decoded instruction cache.
+ * RAM is split in pages; a page of decoded instructions is allocated
+ * the first time the PC enters it. Each entry starts as a "decode" stub
+ * which decodes the instruction in place on its first execution.
+ * Undecoded entries have opcode 0, which no instruction uses.
+ */
+struct icache_t
+{
+    struct minirisc_t *minirisc;
+    uint32_t n_pages;
+    struct insn_t **pages; /* One decoded page per RAM page, NULL until executed */
+    struct insn_t scratch; /* Used for instructions fetched outside RAM */
+    const void *undecoded_label; /* Label given to undecoded entries, set by the threaded engine */
+};
+
+/**
+ * Allocate a cache covering the RAM of the minirisc's platform.
+ */
+struct icache_t *icache_new(struct minirisc_t *minirisc);
+
+/**
+ * Free all decoded pages and the cache itself.
+ */
+void icache_free(struct icache_t *icache);
+
+/**
+ * Slow path of icache_lookup(): allocate the page or decode in the scratch entry.
+ */
+struct insn_t *icache_fill(struct icache_t *icache, uint32_t pc);
+
+/**
+ * Reset every entry of the cache to the undecoded state.
+ */
+void icache_flush(struct icache_t *icache);
+
+/**
+ * Decode the instruction at pc into insn, in place.
+ * Used by the threaded engine on undecoded entries (opcode 0).
+ */
+void icache_decode(struct icache_t *icache, struct insn_t *insn, uint32_t pc);
+
+/**
+ * Drop the decoded instructions overlapping [addr, addr + len).
+ */
+void icache_invalidate(struct icache_t *icache, uint32_t addr, uint32_t len);
+
+/**
+ * Return the decoded instruction at pc.
+ */
+static inline struct insn_t *icache_lookup(struct icache_t *icache, uint32_t pc)
+{
+    uint32_t offset = pc - RAM_BASE;
+    struct insn_t *page;
+
+    if (((offset >> PAGE_SHIFT) < icache->n_pages) && !(pc & 0x3) && (page = icache->pages[offset >> PAGE_SHIFT]) != NULL)
+        return &page[(offset & PAGE_MASK) >> 2];
+
+    return icache_fill(icache, pc);
+}
+
+#endif
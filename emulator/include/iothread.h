@@ -0,0 +1,109 @@
+#ifndef H_IOTHREAD
+#define H_IOTHREAD
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define IOTHREAD_CONSOLE_SIZE (1 << 20) /* Bytes of console output in flight, power of two */
+#define IOTHREAD_MAX_SINKS 4
+#define IOTHREAD_LOG_SIZE 256           /* Longest iothread_printf() record */
+
+enum iothread_policy_t
+{
+    IOTHREAD_BLOCK, /* The emulation thread waits for room in the console ring: nothing is lost */
+    IOTHREAD_DROP,  /* Console output that does not fit in the ring is lost and counted */
+};
+
+/**
+ * Drain one unit of work of a sink (a frame, a trace buffer...).
+ * Called on the I/O thread.
+ * @return 0 if the sink had nothing to write
+ */
+typedef int (*iothread_drain_t)(void *opaque);
+
+/**
+ * Host I/O thread. Everything the devices show to the host goes through
+ * it, so that a slow terminal, pipe or disk never stalls the emulation
+ * thread:
+ *  - console output and log records are copied into a single-producer
+ *    single-consumer byte ring, written to stdout by the thread;
+ *  - sinks (frame recorder, trace writer) keep their own rings and are
+ *    drained by the thread in turn.
+ * The emulation thread only makes a system call when the console ring is
+ * full and the policy is IOTHREAD_BLOCK.
+ */
+struct iothread_t
+{
+    enum iothread_policy_t policy;
+    uint8_t *console;
+    _Atomic uint32_t head; /* Next byte to write, advanced by the I/O thread */
+    _Atomic uint32_t tail; /* Next byte to fill, advanced by the emulation thread */
+    uint64_t dropped;      /* Console bytes lost with IOTHREAD_DROP */
+    struct
+    {
+        iothread_drain_t drain;
+        void *opaque;
+    } sinks[IOTHREAD_MAX_SINKS];
+    uint32_t n_sinks;
+    _Atomic uint64_t sync_requested; /* Last iothread_sync() generation */
+    _Atomic uint64_t sync_done;      /* Generation seen by the last pass that found nothing to do */
+    atomic_int stop;
+    int running;
+    pthread_t thread;
+};
+
+/**
+ * Parse "block" or "drop".
+ * @return -1 if the name is unknown
+ */
+int iothread_parse_policy(const char *name, enum iothread_policy_t *policy);
+
+/**
+ * Allocate the console ring and start the thread.
+ */
+struct iothread_t *iothread_new(void);
+
+/**
+ * Stop the thread and free everything. The sinks must have been removed.
+ */
+void iothread_free(struct iothread_t *io);
+
+/**
+ * Write everything posted so far, then stop the thread, e.g. before fork().
+ */
+void iothread_stop(struct iothread_t *io);
+
+/**
+ * Start the thread again after iothread_stop().
+ */
+void iothread_start(struct iothread_t *io);
+
+/**
+ * Wait until everything posted so far has been written, before the host
+ * prints on its own or reads the terminal.
+ */
+void iothread_sync(struct iothread_t *io);
+
+/**
+ * Have the thread drain opaque with drain.
+ */
+void iothread_add_sink(struct iothread_t *io, iothread_drain_t drain, void *opaque);
+
+/**
+ * Drain the sink one last time and forget it.
+ */
+void iothread_remove_sink(struct iothread_t *io, void *opaque);
+
+/**
+ * Post console output, from the emulation thread.
+ */
+void iothread_write(struct iothread_t *io, const void *data, size_t len);
+
+/**
+ * Post a log record, ordered with the console output.
+ */
+void iothread_printf(struct iothread_t *io, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef H_JIT
+#define H_JIT
+
+#include <inttypes.h>
+#include "minirisc.h"
+#include "block.h"
+
+#define JIT_CODE_SIZE (16 * 1024 * 1024)
+#define JIT_HOT_THRESHOLD 32      /* Executions of a block before it is compiled */
+#define JIT_MAX_BLOCK_CODE 16384 /* Upper bound of the native code for one block */
+
+/**
+ * x86-64 translator for hot blocks.
+ * Native code is emitted in an executable mmap'd buffer, guest registers
+ * stay in minirisc_t.regs. RAM loads and stores are inlined; MMIO, faults,
+ * writes to code pages and the less common instructions call the
+ * interpreter handlers.
+ */
+struct jit_t
+{
+    uint8_t *code;
+    uint32_t code_used;
+    struct block_cache_t *cache;
+};
+
+/**
+ * Allocate the executable buffer.
+ * @return NULL if the host is not x86-64 or the mapping failed
+ */
+struct jit_t *jit_new(struct block_cache_t *cache);
+
+/**
+ * Unmap the buffer and free the JIT.
+ */
+void jit_free(struct jit_t *jit);
+
+/**
+ * Drop all native code. Called when the block cache is flushed.
+ */
+void jit_flush(struct jit_t *jit);
+
+/**
+ * Translate block to native code and set block->native.
+ * When the buffer is full, ask for a block cache flush instead.
+ */
+void jit_compile(struct jit_t *jit, struct block_t *block);
+
+#endif
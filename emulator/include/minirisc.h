@@ -3,6 +3,49 @@
 
 #include <inttypes.h>
 #include "platform.h"
+#include "stats.h"
+#include "types.h"
+
+struct minirisc_t;
+struct insn_t;
+struct profile_t;
+struct callgraph_t;
+struct trace_t;
+struct mtimer_t;
+struct ecall_t;
+struct hle_t;
+
+typedef void (*insn_exec_t)(struct minirisc_t *minirisc, struct insn_t *insn);
+
+/**
+ * A decoded instruction: handler, register indices and
+ * immediate already shifted and sign-extended.
+ */
+struct insn_t
+{
+    insn_exec_t exec;
+    const void *label; /* Handler address in the threaded engine */
+    uint32_t imm;
+    uint32_t raw; /* Instruction word, kept for diagnostics */
+    uint8_t opcode;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t rs3; /* Bits 22-26 (DIVL, DIVLU, fused multiply-adds) */
+    uint8_t rd2; /* Bits 27-31 (DIVL, DIVLU), the rounding mode of F / D instructions in its low 3 bits */
+};
+
+/**
+ * Execution engines selectable at runtime.
+ */
+enum minirisc_engine_t
+{
+    ENGINE_INTERP = 0, /* One decoded instruction per dispatch */
+    ENGINE_BLOCK = 1,  /* Chained basic blocks of micro-ops */
+    ENGINE_JIT = 2,    /* Block engine, hot blocks compiled to x86-64 */
+    ENGINE_SWITCH = 3, /* Decoded instructions, one switch on the opcode */
+    ENGINE_THREADED = 4, /* Decoded instructions, computed goto at the end of each handler */
+};
 
 struct minirisc_t
 {
@@ -10,8 +53,24 @@ struct minirisc_t
     uint32_t IR;       /* Instruction register: instruction being executed */
     uint32_t next_PC;  /* Value used to update the PC after the exec stage */
     uint32_t regs[32]; /* Registers */
+    uint64_t fregs[32]; /* F / D registers, singles NaN-boxed (upper word all ones) */
+    uint32_t fcsr;      /* fflags in bits 0-4, frm in bits 5-7 */
     struct platform_t *platform;
+    struct icache_t *icache;
+    struct block_cache_t *blocks; /* Allocated when the block engine is selected */
+    enum minirisc_engine_t engine;
     int halt;
+    uint64_t instret;     /* Instructions executed, including the one that halted */
+    uint64_t max_instret; /* minirisc_run() returns when instret reaches it */
+    int exited;           /* The guest stopped with EBREAK (_exit), exit_code is valid */
+    uint32_t exit_code;   /* a0 at the EBREAK */
+    struct stats_t stats;
+    struct profile_t *profile; /* Execution profile, NULL unless profiling (interp, block and jit engines) */
+    struct callgraph_t *callgraph; /* Shadow call stack, NULL unless enabled (interp and block engines) */
+    struct trace_t *trace; /* Execution trace writer, NULL unless tracing (interp engine) */
+    struct mtimer_t *timer; /* Timer device, NULL until main() creates it */
+    struct ecall_t *ecall;  /* Host call bridge, NULL: ECALL returns -1 */
+    struct hle_t *hle;      /* Host routines replacing guest functions, NULL unless enabled */
 };
 
 /**
@@ -35,12 +94,62 @@ void minirisc_fetch(struct minirisc_t *minirisc);
 void minirisc_decode_and_execute(struct minirisc_t *minirisc);
 
 /**
- * Run the processor:
- * minirisc_fetch() and minirisc_decode_and_execute()
- * in a loop while halt is false.
+ * Decode the instruction word instr into insn.
+ */
+void minirisc_decode(uint32_t instr, struct insn_t *insn);
+
+/**
+ * Decode the instruction word instr fetched at pc into insn,
+ * with the high-level emulation hooks.
+ */
+void minirisc_decode_at(struct minirisc_t *minirisc, uint32_t pc, uint32_t instr, struct insn_t *insn);
+
+/**
+ * Decode an instruction that could not be fetched (PC outside RAM or
+ * misaligned): it ends the block and halts the CPU as a guest fault.
+ */
+void minirisc_decode_fetch_fault(struct insn_t *insn);
+
+/**
+ * Execute the single instruction at PC through the instruction cache.
+ */
+void minirisc_step(struct minirisc_t *minirisc);
+
+/**
+ * Select the execution engine by name:
+ * "interp", "switch", "threaded", "block" or "jit".
+ * @return 0 on success, -1 if the name is unknown
+ */
+int minirisc_set_engine(struct minirisc_t *minirisc, const char *name);
+
+/**
+ * True for the instructions that end a basic block:
+ * jumps, branches, ECALL, EBREAK and unknown opcodes.
+ * Opcodes 40-63 are all used (DIVL, F / D, M).
+ */
+static inline int minirisc_insn_ends_block(const struct insn_t *insn)
+{
+    return (insn->opcode >= JAL_CODE && insn->opcode <= BGEU_CODE) ||
+           insn->opcode == ECALL_CODE || insn->opcode == EBREAK_CODE ||
+           insn->opcode > FCVT_D_WU_CODE;
+}
+
+/**
+ * Run the processor with the selected engine
+ * while halt is false and instret is below max_instret.
+ * Returns with halt clear when the instruction limit is reached:
+ * raising max_instret and calling it again resumes the guest.
  */
 void minirisc_run(struct minirisc_t *minirisc);
 
+/**
+ * Load or store for the instruction being executed: counted and traced
+ * like the integer loads and stores.
+ * @return -1 on a fault
+ */
+int minirisc_load(struct minirisc_t *minirisc, enum access_type_t type, uint32_t addr, uint32_t *data);
+int minirisc_store(struct minirisc_t *minirisc, enum access_type_t type, uint32_t addr, uint32_t data);
+
 void extend_sign(uint32_t *imm, int n);
 
 void set_reg(struct minirisc_t *minirisc, int reg, uint32_t value);
@@ -0,0 +1,67 @@
+#ifndef H_MTIMER
+#define H_MTIMER
+
+#include <inttypes.h>
+#include <time.h>
+#include "minirisc.h"
+
+/* Registers of the timer device, at MTIMER_BASE */
+#define MTIMER_TIME 0x00    /* R: time in microseconds, low word; reading it latches the high word */
+#define MTIMER_TIME_HI 0x04 /* R: high word latched by the last MTIMER_TIME read */
+#define MTIMER_FREQ 0x08    /* R: ticks per second of MTIMER_TIME (1000000) */
+#define MTIMER_SLEEP 0x0C   /* W: wait this many microseconds */
+#define MTIMER_SIZE 0x10
+
+#define MTIMER_DEFAULT_FREQ 100000000 /* Guest instructions per second of the virtual clock */
+
+enum mtimer_mode_t
+{
+    MTIMER_VIRTUAL, /* Retired instructions at a fixed frequency: identical on every run and engine */
+    MTIMER_HOST,    /* Host monotonic clock, for interactive use */
+    MTIMER_PACED,   /* Virtual clock, the host waits whenever it gets ahead of real time */
+};
+
+/**
+ * Timer device. Devices are called before the accessing instruction is
+ * counted in instret, whatever the engine, so the virtual clock only
+ * depends on the instructions the guest executed and on its sleeps.
+ */
+struct mtimer_t
+{
+    struct minirisc_t *minirisc;
+    enum mtimer_mode_t mode;
+    uint64_t freq;         /* Virtual clock frequency, in instructions per second */
+    uint64_t slept;        /* Microseconds added to the virtual clock by MTIMER_SLEEP */
+    struct timespec start; /* Host time at mtimer_start() */
+    uint64_t origin;       /* Guest time at mtimer_start() */
+    uint32_t latched_hi;
+};
+
+/**
+ * Parse "virtual", "host" or "paced".
+ * @return -1 if the name is unknown
+ */
+int mtimer_parse_mode(const char *name, enum mtimer_mode_t *mode);
+
+/**
+ * Create the device and map it at MTIMER_BASE on the minirisc's platform.
+ */
+struct mtimer_t *mtimer_new(struct minirisc_t *minirisc, enum mtimer_mode_t mode, uint64_t freq);
+
+/**
+ * Free the device. Its mapping is freed with the platform.
+ */
+void mtimer_free(struct mtimer_t *mtimer);
+
+/**
+ * Start the host and paced clocks from the current guest time, so that
+ * a restored VM carries on from the time of its checkpoint.
+ */
+void mtimer_start(struct mtimer_t *mtimer);
+
+/**
+ * Current guest time in microseconds, as read from MTIMER_TIME.
+ */
+uint64_t mtimer_now(struct mtimer_t *mtimer);
+
+#endif
@@ -2,12 +2,36 @@
 #define H_PLATFORM
 
 #include <inttypes.h>
+#include "types.h"
+#include "stats.h"
 
-struct platform_t
-{
-    uint32_t size;
-    uint32_t *memory;
-};
+struct framebuffer_t;
+struct iothread_t;
+struct dma_t;
+
+#define PLATFORM_DEFAULT_RAM_SIZE (64 * 1024 * 1024)
+#define PLATFORM_MAX_RAM_SIZE (0u - RAM_BASE) /* RAM ends at the top of the address space */
+
+#define L1_BITS 10
+#define L2_BITS (32 - PAGE_SHIFT - L1_BITS)
+#define L2_SIZE (1 << L2_BITS)
+
+#define TLB_BITS 8
+#define TLB_SIZE (1 << TLB_BITS)
+#define TLB_INVALID PAGE_MASK /* Never equal to a masked address, see platform_read() */
+
+/* Registers of the charOut console, at CHAROUT_BASE */
+#define CHAROUT_CHAR 0x00     /* W: one character */
+#define CHAROUT_INT 0x04      /* W: a signed decimal number */
+#define CHAROUT_HEX 0x08      /* W: a 0x%08x number */
+#define CHAROUT_BUF_ADDR 0x0C /* RW: guest address of the next CHAROUT_BUF_LEN write */
+#define CHAROUT_BUF_LEN 0x10  /* W: print that many bytes from CHAROUT_BUF_ADDR at once */
+#define CHAROUT_SIZE 0x14
+
+/* Page flags */
+#define PAGE_READ 0x1
+#define PAGE_WRITE 0x2
+#define PAGE_CODE 0x4 /* The CPU caches decoded code from this page */
 
 /**
  * Type of memory acess
@@ -19,35 +43,196 @@ enum access_type_t
     ACCESS_WORD = 2  // 32 bits
 };
 
+/**
+ * Memory mapped device. Offsets are relative to the base of the device.
+ * Callbacks return 0 on success, -1 on an invalid access.
+ */
+struct device_t
+{
+    const char *name;
+    uint32_t base;
+    uint32_t size;
+    int (*read)(void *opaque, uint32_t offset, enum access_type_t access_type, uint32_t *data);
+    int (*write)(void *opaque, uint32_t offset, enum access_type_t access_type, uint32_t data);
+    void *opaque;
+    struct device_t *next;
+};
+
+/**
+ * One 4 KiB page of the guest address space: host memory or a device.
+ */
+struct page_t
+{
+    uint8_t *host;            /* Host memory backing the page, NULL for devices */
+    struct device_t *device;
+    uint32_t flags;
+};
+
+/**
+ * Software TLB entry: a guest page translated to host memory.
+ * host address = guest address + addend
+ */
+struct tlb_entry_t
+{
+    uint32_t page; /* Guest page address, TLB_INVALID when empty */
+    uintptr_t addend;
+};
+
+struct platform_t
+{
+    uint32_t size;    /* Main RAM, mapped at RAM_BASE */
+    uint32_t *memory;
+    struct tlb_entry_t tlb_read[TLB_SIZE];
+    struct tlb_entry_t tlb_write[TLB_SIZE]; /* Writable pages without cached code only */
+    struct page_t *pages[1 << L1_BITS];     /* Two-level page table, second levels allocated on demand */
+    struct device_t *devices;
+    void (*code_write)(void *opaque, uint32_t addr, uint32_t len);
+    void *code_write_opaque;
+    uint64_t mmio_accesses; /* Device reads and writes, counted with MINIRISC_STATS */
+    struct framebuffer_t *framebuffer;
+    struct dma_t *dma;
+    uint32_t charout_buffer; /* CHAROUT_BUF_ADDR register */
+    struct iothread_t *io;   /* Console output and log records */
+};
+
 /**
  * Allocates and initializes a new platform and its memory.
+ * RAM is an anonymous MAP_NORESERVE mapping: it reads as zero and
+ * costs no host memory until the guest writes to it.
+ * @param ram_size Size of the RAM mapped at RAM_BASE, a multiple of PAGE_SIZE
+ *                 no larger than PLATFORM_MAX_RAM_SIZE
  */
-struct platform_t *platform_new();
+struct platform_t *platform_new(uint32_t ram_size);
 
 /**
  * Cleanup the platform's allocated memories.
  */
 void platform_free(struct platform_t *platform);
 
+/**
+ * Slow path of platform_read(): TLB misses, devices, unmapped and misaligned accesses.
+ */
+int platform_read_slow(struct platform_t *plt, enum access_type_t access_type, uint32_t addr, uint32_t *data);
+
+/**
+ * Slow path of platform_write(): TLB misses, devices, unmapped, read-only
+ * and misaligned accesses, and writes to pages holding cached code.
+ */
+int platform_write_slow(struct platform_t *plt, enum access_type_t access_type, uint32_t addr, uint32_t data);
+
 /**
  * Read one item from the platform.
+ * A hit in the read TLB is served inline: the tag compare also rejects
+ * misaligned addresses, whose low bits survive the mask.
+ * Everything else goes to platform_read_slow().
  * @param platform The platform object
  * @param type     Width of the access
  * @param addr     Address where to read the item
  * @param data     The item is placed in data.
  * @return         0 on success, -1 on error (illegal or misaligned access)
  */
-int platform_read(struct platform_t *plt, enum access_type_t access_type, uint32_t addr, uint32_t *data);
+static inline int platform_read(struct platform_t *plt, enum access_type_t access_type, uint32_t addr, uint32_t *data)
+{
+    struct tlb_entry_t *entry = &plt->tlb_read[(addr >> PAGE_SHIFT) & (TLB_SIZE - 1)];
+    uint8_t *p = (uint8_t *)(addr + entry->addend);
+
+    if (__builtin_expect(entry->page == (addr & (~PAGE_MASK | ((1 << access_type) - 1))), 1))
+    {
+        switch (access_type)
+        {
+        case ACCESS_BYTE:
+            *data = *p;
+            return 0;
+        case ACCESS_HALF:
+            *data = *(uint16_t *)p;
+            return 0;
+        case ACCESS_WORD:
+            *data = *(uint32_t *)p;
+            return 0;
+        }
+    }
+
+    return platform_read_slow(plt, access_type, addr, data);
+}
 
 /**
  * Write one item to the platform.
+ * A hit in the write TLB is served inline, everything else goes to
+ * platform_write_slow().
  * @param platform The platform object
  * @param type     Width of the access
  * @param addr     Address where to write the item
  * @param data     The item to write
  * @return         0 on success, -1 on error (illegal or misaligned access)
  */
-int platform_write(struct platform_t *plt, enum access_type_t access_type, uint32_t addr, uint32_t data);
+static inline int platform_write(struct platform_t *plt, enum access_type_t access_type, uint32_t addr, uint32_t data)
+{
+    struct tlb_entry_t *entry = &plt->tlb_write[(addr >> PAGE_SHIFT) & (TLB_SIZE - 1)];
+    uint8_t *p = (uint8_t *)(addr + entry->addend);
+
+    if (__builtin_expect(entry->page == (addr & (~PAGE_MASK | ((1 << access_type) - 1))), 1))
+    {
+        switch (access_type)
+        {
+        case ACCESS_BYTE:
+            *p = data;
+            return 0;
+        case ACCESS_HALF:
+            *(uint16_t *)p = data;
+            return 0;
+        case ACCESS_WORD:
+            *(uint32_t *)p = data;
+            return 0;
+        }
+    }
+
+    return platform_write_slow(plt, access_type, addr, data);
+}
+
+/**
+ * Map [base, base + size) to host memory. Both must be page aligned.
+ * @param flags PAGE_READ, plus PAGE_WRITE unless the region is a ROM
+ */
+void platform_map_memory(struct platform_t *platform, uint32_t base, uint32_t size, void *host, uint32_t flags);
+
+/**
+ * Map a device at [base, base + size), rounded up to whole pages.
+ * The platform keeps the returned descriptor and frees it with itself.
+ */
+struct device_t *platform_add_device(struct platform_t *platform, const char *name, uint32_t base, uint32_t size,
+                                     int (*read)(void *opaque, uint32_t offset, enum access_type_t access_type, uint32_t *data),
+                                     int (*write)(void *opaque, uint32_t offset, enum access_type_t access_type, uint32_t data),
+                                     void *opaque);
+
+/**
+ * Return the page holding addr, NULL if it is unmapped.
+ */
+struct page_t *platform_page(struct platform_t *platform, uint32_t addr);
+
+/**
+ * Empty both TLBs. Needed whenever the memory map changes.
+ */
+void platform_tlb_flush(struct platform_t *platform);
+
+/**
+ * Register the callback invoked when a write hits a page holding cached code.
+ */
+void platform_set_code_write_hook(struct platform_t *platform, void (*hook)(void *opaque, uint32_t addr, uint32_t len), void *opaque);
+
+/**
+ * Flag the page holding addr as containing cached code:
+ * it leaves the write TLB and later writes to it call the code write hook.
+ */
+void platform_mark_code(struct platform_t *platform, uint32_t addr);
+
+/**
+ * Host view of the guest range [addr, addr + len), for devices and host
+ * calls that move whole buffers. The range must lie in RAM; with write,
+ * its pages must be writable and those holding cached code get the code
+ * write hook, as stores would.
+ * @return NULL if the range is not entirely in (writable) RAM
+ */
+void *platform_host_range(struct platform_t *platform, uint32_t addr, uint32_t len, int write);
 
 /**
  * Read the file named file_name and write its content
@@ -0,0 +1,51 @@
+#ifndef H_PROFILE
+#define H_PROFILE
+
+#include <inttypes.h>
+#include "types.h"
+#include "elf_loader.h"
+
+#define PROFILE_TOP_PCS 50 /* Hottest instructions listed in the report */
+
+/**
+ * Execution profile: exact count of executions of every RAM
+ * instruction word. The interpreter counts each instruction; the block
+ * engines count block entries and add them to the words of the block
+ * when the block cache is flushed or the engine returns.
+ */
+struct profile_t
+{
+    uint64_t *counts; /* MAP_NORESERVE: only pages holding code cost memory */
+    uint32_t n_words;
+};
+
+/**
+ * Allocate a profile covering a RAM of ram_size bytes.
+ */
+struct profile_t *profile_new(uint32_t ram_size);
+
+/**
+ * Free the profile and its counters.
+ */
+void profile_free(struct profile_t *profile);
+
+/**
+ * Add n executions to the instruction at pc. Instructions outside RAM are not counted.
+ */
+static inline void profile_add(struct profile_t *profile, uint32_t pc, uint64_t n)
+{
+    uint32_t word = (pc - RAM_BASE) >> 2;
+
+    if (word < profile->n_words)
+        profile->counts[word] += n;
+}
+
+/**
+ * Write the hotspot report to file_name: instructions per function
+ * (symbols from elf, which may be NULL), then the hottest instructions,
+ * both sorted by decreasing count.
+ * @return 0 on success, -1 if the file could not be written
+ */
+int profile_write_report(struct profile_t *profile, struct elf_t *elf, const char *file_name);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef H_RECORDER
+#define H_RECORDER
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+#include "framebuffer.h"
+
+#define RECORDER_SLOTS 8   /* Frames in flight, power of two */
+#define RECORDER_Y4M_FPS 35 /* Doom's tic rate */
+
+enum recorder_format_t
+{
+    RECORDER_Y4M,  /* One YUV4MPEG2 stream, 4:4:4 */
+    RECORDER_PPM,  /* One binary PPM file per frame: FILE000042.ppm */
+    RECORDER_RGBA, /* Raw RGBA bytes, frames one after the other */
+};
+
+struct recorder_frame_t
+{
+    uint64_t number; /* Frame number given by the framebuffer doorbell, from 0 */
+    uint32_t width;
+    uint32_t height;
+    uint32_t *pixels; /* Copy of the guest buffer, 0x00RRGGBB */
+    size_t capacity;  /* Pixels allocated */
+};
+
+/**
+ * Frame recorder.
+ * On the doorbell, the emulation thread copies every Nth frame into a
+ * free slot of a single-producer single-consumer ring; the I/O thread
+ * converts the slots in order, writes them and releases them. The
+ * emulation thread never waits: when all slots are in flight the frame
+ * is dropped and counted.
+ */
+struct recorder_t
+{
+    struct framebuffer_t *fb;
+    enum recorder_format_t format;
+    uint32_t every;
+    const char *file_name;
+    struct recorder_frame_t slots[RECORDER_SLOTS];
+    _Atomic uint32_t head; /* Next slot to write, advanced by the I/O thread */
+    _Atomic uint32_t tail; /* Next slot to fill, advanced by the emulation thread */
+    uint64_t captured;     /* Frames put in the ring */
+    uint64_t dropped;      /* Frames lost because the ring was full */
+    /* Only used by the I/O thread */
+    FILE *file;            /* NULL for PPM sequences */
+    uint8_t *conversion;
+    size_t conversion_size;
+    uint32_t y4m_width;    /* Size given in the Y4M header, 0 before the first frame */
+    uint32_t y4m_height;
+    uint64_t written;
+    uint64_t skipped;      /* Y4M frames whose size differs from the first one */
+    int error;
+};
+
+/**
+ * Parse "y4m", "ppm" or "rgba".
+ * @return -1 if the name is unknown
+ */
+int recorder_parse_format(const char *name, enum recorder_format_t *format);
+
+/**
+ * Start recording every Nth frame of fb to file_name (the file prefix
+ * for PPM sequences).
+ * @return NULL if the file could not be opened
+ */
+struct recorder_t *recorder_open(struct framebuffer_t *fb, const char *file_name, enum recorder_format_t format,
+                                 uint32_t every);
+
+/**
+ * Write the frames still in the ring and close the file.
+ * @return 0 on success, -1 if the frames could not be written
+ */
+int recorder_close(struct recorder_t *recorder);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef H_STATS
+#define H_STATS
+
+#include <inttypes.h>
+
+struct minirisc_t;
+
+/**
+ * Event counters of a run. They are only updated when the emulator is
+ * built with MINIRISC_STATS (make STATS=1, the default); otherwise the
+ * STATS_* macros expand to nothing. Executed instructions are always
+ * counted, in minirisc_t.instret.
+ */
+struct stats_t
+{
+    uint64_t loads;
+    uint64_t stores;
+    uint64_t branches_taken;
+    uint64_t branches_not_taken;
+    uint64_t start_instret; /* instret when the run started (restored from a checkpoint), for the MIPS */
+};
+
+#ifdef MINIRISC_STATS
+#define STATS_ADD(counter, n) ((counter) += (n))
+#else
+#define STATS_ADD(counter, n) ((void)0)
+#endif
+#define STATS_INC(counter) STATS_ADD(counter, 1)
+
+/**
+ * Print the counters of the run, seconds being its wall time.
+ */
+void stats_print(struct minirisc_t *minirisc, double seconds);
+
+/**
+ * Write the counters of the run as a JSON object to file_name.
+ * @return 0 on success, -1 if the file could not be written
+ */
+int stats_write_json(struct minirisc_t *minirisc, double seconds, const char *file_name);
+
+#endif
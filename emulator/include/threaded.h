@@ -0,0 +1,18 @@
+#ifndef H_THREADED
+#define H_THREADED
+
+#include "minirisc.h"
+
+/**
+ * Run the decoded instructions with a single switch on the opcode.
+ */
+void threaded_run_switch(struct minirisc_t *minirisc);
+
+/**
+ * Run the decoded instructions with direct threading: each handler ends
+ * with its own indirect jump to the label stored in the next instruction.
+ * Falls back to threaded_run_switch() if the compiler has no labels-as-values.
+ */
+void threaded_run(struct minirisc_t *minirisc);
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef H_TRACE
+#define H_TRACE
+
+#include <inttypes.h>
+#include <stdatomic.h>
+
+struct iothread_t;
+
+#define TRACE_MAGIC "MRTRACE1"
+#define TRACE_HEADER_SIZE 16     /* Magic, entry PC, reserved word */
+#define TRACE_BUFFER_SIZE (1 << 20)
+#define TRACE_BUFFERS 8          /* Buffers in flight, power of two */
+#define TRACE_MAX_EVENT 16       /* Upper bound of one encoded event */
+
+/**
+ * Trace format: after the header, a stream of LEB128 varints v whose
+ * low 2 bits give the event kind. A cursor starts at the entry PC.
+ *  - TRACE_EXEC:   v >> 2 instructions were executed at cursor, cursor + 4, ...
+ *                  and the cursor moves past them.
+ *  - TRACE_JUMP:   the cursor moves by zigzag(v >> 2) bytes (a taken branch or jump).
+ *  - TRACE_LOAD,
+ *    TRACE_STORE:  memory access of the last executed instruction;
+ *                  (v >> 2) & 3 is the access type (log2 of the width) and
+ *                  v >> 4 is zigzag(addr - address of the previous access).
+ * The whole stream is gzip-compressed when built with zlib.
+ * Only the accesses of guest loads and stores are traced: the bulk copies
+ * done by devices (DMA) and ECALLs (read, write) on guest RAM are not.
+ */
+enum trace_event_t
+{
+    TRACE_EXEC = 0,
+    TRACE_JUMP = 1,
+    TRACE_LOAD = 2,
+    TRACE_STORE = 3,
+};
+
+struct trace_buffer_t
+{
+    uint32_t used;
+    uint8_t data[TRACE_BUFFER_SIZE];
+};
+
+/**
+ * Single-producer single-consumer ring of buffers.
+ */
+struct trace_ring_t
+{
+    struct trace_buffer_t *slots[TRACE_BUFFERS];
+    _Atomic uint32_t head; /* Next slot to pop, written by the consumer */
+    _Atomic uint32_t tail; /* Next slot to push, written by the producer */
+};
+
+/**
+ * Execution trace writer.
+ * The emulator encodes events in the current buffer; full buffers go to
+ * the I/O thread through the `full` ring, which compresses them, writes
+ * them and hands them back through the `free` ring. When all buffers are
+ * in flight the emulator waits: the trace is never lossy.
+ */
+struct trace_t
+{
+    struct trace_buffer_t *buffer; /* Being filled by the emulator */
+    uint8_t *p;                    /* Write position in buffer */
+    uint8_t *end;                  /* Last position where an event always fits */
+    uint32_t next_pc;              /* Cursor: PC expected for the next instruction */
+    uint32_t last_addr;            /* Address of the previous memory access */
+    uint64_t run;                  /* Sequential instructions not yet encoded */
+    uint32_t n_buffers;            /* Buffers allocated so far */
+    struct trace_ring_t full;
+    struct trace_ring_t free;
+    struct iothread_t *io;
+    void *file; /* gzFile or FILE *, only used by the I/O thread */
+    int error;  /* Set by the I/O thread */
+};
+
+/**
+ * Open file_name and have io write the trace. entry is the first PC.
+ * @return NULL if the file could not be opened
+ */
+struct trace_t *trace_open(const char *file_name, uint32_t entry, struct iothread_t *io);
+
+/**
+ * Encode the pending events, wait for the I/O thread and close the file.
+ * @return 0 on success, -1 if the trace could not be written
+ */
+int trace_close(struct trace_t *trace);
+
+/**
+ * Slow path: hand the current buffer to the I/O thread and take an empty one.
+ */
+void trace_submit(struct trace_t *trace);
+
+static inline void trace_put(struct trace_t *trace, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        *trace->p++ = v | 0x80;
+        v >>= 7;
+    }
+    *trace->p++ = v;
+}
+
+static inline uint64_t trace_zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline void trace_flush_run(struct trace_t *trace)
+{
+    if (trace->run)
+    {
+        trace_put(trace, trace->run << 2 | TRACE_EXEC);
+        trace->run = 0;
+        if (trace->p > trace->end)
+            trace_submit(trace);
+    }
+}
+
+/**
+ * Called before executing the instruction at pc.
+ */
+static inline void trace_insn(struct trace_t *trace, uint32_t pc)
+{
+    if (pc != trace->next_pc)
+    {
+        trace_flush_run(trace);
+        trace_put(trace, trace_zigzag((int32_t)(pc - trace->next_pc)) << 2 | TRACE_JUMP);
+        if (trace->p > trace->end)
+            trace_submit(trace);
+    }
+    trace->run++;
+    trace->next_pc = pc + 4;
+}
+
+/**
+ * Called for each load or store of the instruction being executed.
+ * type is the access_type_t of the access.
+ */
+static inline void trace_access(struct trace_t *trace, enum trace_event_t event, uint32_t addr, uint32_t type)
+{
+    trace_flush_run(trace);
+    trace_put(trace, (trace_zigzag((int32_t)(addr - trace->last_addr)) << 4) | (type << 2) | event);
+    trace->last_addr = addr;
+    if (trace->p > trace->end)
+        trace_submit(trace);
+}
+
+#endif
@@ -2,8 +2,16 @@
 #define H_TYPES
 
 #define CHAROUT_BASE 0x10000000
+#define VMCTL_BASE 0x10001000
+#define FB_BASE 0x10002000
+#define MTIMER_BASE 0x10003000
+#define DMA_BASE 0x10004000
 #define RAM_BASE 0x80000000
 
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define PAGE_MASK (PAGE_SIZE - 1)
+
 #define LUI_CODE 1
 #define AUIPC_CODE 2
 #define JAL_CODE 3
@@ -43,6 +51,36 @@
 #define AND_CODE 37
 #define ECALL_CODE 38
 #define EBREAK_CODE 39
+/*
+ * MINIRISC extension, 64 / 32 division with remainder:
+ * rd = rs2:rs1 / rs3, rd2 = rs2:rs1 % rs3 (rs3 in bits 22-26, rd2 in bits 27-31).
+ * The quotient is truncated to 32 bits. Division by zero gives a quotient
+ * of all ones and the low word of the dividend as remainder, as DIV / REM.
+ */
+#define DIVL_CODE 40
+#define DIVLU_CODE 41
+/*
+ * F and D extensions. rd, rs1 and rs2 name f or x registers depending on
+ * the instruction, rs3 (bits 22-26) is the addend of the fused
+ * multiply-adds and bits 27-29 hold the RISC-V rounding mode (7: fcsr.frm).
+ * FLW / FLD use the load format, FSW / FSD the store format (value in rd).
+ * FCSRR*: rd = csr, then csr = rs1 / csr | rs1 / csr & ~rs1, the CSR number
+ * (1 fflags, 2 frm, 3 fcsr) in imm.
+ */
+#define FLW_CODE 42
+#define FSW_CODE 43
+#define FLD_CODE 44
+#define FSD_CODE 45
+#define FMADD_S_CODE 46
+#define FMSUB_S_CODE 47
+#define FNMSUB_S_CODE 48
+#define FNMADD_S_CODE 49
+#define FMADD_D_CODE 50
+#define FMSUB_D_CODE 51
+#define FNMSUB_D_CODE 52
+#define FNMADD_D_CODE 53
+#define FCSRRW_CODE 54
+#define FCSRRS_CODE 55
 #define MUL_CODE 56
 #define MULH_CODE 57
 #define MULHSU_CODE 58
@@ -51,6 +89,47 @@
 #define DIVU_CODE 61
 #define REM_CODE 62
 #define REMU_CODE 63
+#define FCSRRC_CODE 64
+#define FADD_S_CODE 65
+#define FSUB_S_CODE 66
+#define FMUL_S_CODE 67
+#define FDIV_S_CODE 68
+#define FSQRT_S_CODE 69
+#define FSGNJ_S_CODE 70
+#define FSGNJN_S_CODE 71
+#define FSGNJX_S_CODE 72
+#define FMIN_S_CODE 73
+#define FMAX_S_CODE 74
+#define FCVT_W_S_CODE 75
+#define FCVT_WU_S_CODE 76
+#define FMV_X_W_CODE 77
+#define FEQ_S_CODE 78
+#define FLT_S_CODE 79
+#define FLE_S_CODE 80
+#define FCLASS_S_CODE 81
+#define FCVT_S_W_CODE 82
+#define FCVT_S_WU_CODE 83
+#define FMV_W_X_CODE 84
+#define FADD_D_CODE 85
+#define FSUB_D_CODE 86
+#define FMUL_D_CODE 87
+#define FDIV_D_CODE 88
+#define FSQRT_D_CODE 89
+#define FSGNJ_D_CODE 90
+#define FSGNJN_D_CODE 91
+#define FSGNJX_D_CODE 92
+#define FMIN_D_CODE 93
+#define FMAX_D_CODE 94
+#define FCVT_W_D_CODE 95
+#define FCVT_WU_D_CODE 96
+#define FCVT_S_D_CODE 97
+#define FCVT_D_S_CODE 98
+#define FEQ_D_CODE 99
+#define FLT_D_CODE 100
+#define FLE_D_CODE 101
+#define FCLASS_D_CODE 102
+#define FCVT_D_W_CODE 103
+#define FCVT_D_WU_CODE 104
 
 #define INT_MAX 0x80000000
 
@@ -0,0 +1,60 @@
+#ifndef H_VMCTL
+#define H_VMCTL
+
+#include <inttypes.h>
+#include <sys/types.h>
+#include "minirisc.h"
+
+/* Registers of the VM control device, at VMCTL_BASE */
+#define VMCTL_MARKER 0 /* W: snapshot point, the value is kept in vmctl_t.marker */
+#define VMCTL_VM_ID 4  /* R: index of this VM among the forked children, 0 if not forked */
+#define VMCTL_SIZE 8
+
+/**
+ * VM control device: lets the guest mark the point where the host takes
+ * a snapshot (fork, checkpoint) and tell the forked copies apart.
+ */
+struct vmctl_t
+{
+    struct minirisc_t *minirisc;
+    int stop_at_marker; /* A marker write stops minirisc_run(), set when a snapshot is wanted */
+    int marker_hit;     /* minirisc_run() returned because of a marker write */
+    uint32_t marker;    /* Last value written to VMCTL_MARKER */
+    uint32_t vm_id;
+};
+
+/**
+ * Create the device and map it at VMCTL_BASE on the minirisc's platform.
+ */
+struct vmctl_t *vmctl_new(struct minirisc_t *minirisc);
+
+/**
+ * Free the device. Its mapping is freed with the platform.
+ */
+void vmctl_free(struct vmctl_t *vmctl);
+
+/**
+ * If minirisc_run() stopped at a marker, clear the stop so that the
+ * guest can be resumed.
+ * @return 1 if it stopped at a marker, 0 otherwise
+ */
+int vmctl_take_marker(struct vmctl_t *vmctl);
+
+/**
+ * Fork n copies of the VM in its current state. Guest RAM, decoded and
+ * translated code are shared copy-on-write by the host fork(): a child
+ * only pays for the pages it writes. Each child reads its index at
+ * VMCTL_VM_ID. pids receives the process ids of the children. If a
+ * fork() fails, the children already started are killed and the process
+ * exits.
+ * @return the index of the child (0 .. n - 1) in each child, -1 in the parent
+ */
+int vm_fork(struct vmctl_t *vmctl, uint32_t n, pid_t *pids);
+
+/**
+ * Wait for the n children started by vm_fork().
+ * statuses[i] receives the exit code of child i, or 128 + signal.
+ */
+void vm_wait(const pid_t *pids, uint32_t n, int *statuses);
+
+#endif
@@ -0,0 +1,255 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "types.h"
+#include "minirisc.h"
+#include "platform.h"
+#include "block.h"
+#include "jit.h"
+#include "profile.h"
+
+struct block_cache_t *block_cache_new()
+{
+    struct block_cache_t *cache;
+
+    if ((cache = calloc(1, sizeof(struct block_cache_t))) == NULL)
+    {
+        printf("Error block cache malloc.\n");
+        return NULL;
+    }
+
+    if ((cache->arena = malloc(BLOCK_ARENA_SIZE)) == NULL)
+    {
+        printf("Error block cache malloc.\n");
+        free(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+void block_cache_free(struct block_cache_t *cache)
+{
+    if (cache->jit)
+        jit_free(cache->jit);
+    free(cache->arena);
+    free(cache);
+}
+
+/**
+ * Add the entries counted in each block to the profile of its instructions.
+ */
+static void block_profile_drain(struct block_cache_t *cache)
+{
+    struct block_t *block;
+    uint32_t i;
+    int h;
+
+    for (h = 0; h < BLOCK_HASH_SIZE; h++)
+    {
+        for (block = cache->hash[h]; block != NULL; block = block->hash_next)
+        {
+            if (block->hits == 0)
+                continue;
+            for (i = 0; i < block->n_insns; i++)
+                profile_add(cache->profile, block->pc + 4 * i, block->hits);
+            block->hits = 0;
+        }
+    }
+}
+
+void block_cache_flush(struct block_cache_t *cache)
+{
+    int i;
+
+    if (cache->profile)
+        block_profile_drain(cache);
+    for (i = 0; i < BLOCK_HASH_SIZE; i++)
+        cache->hash[i] = NULL;
+    cache->arena_used = 0;
+    cache->dirty = 0;
+    cache->generation++;
+    if (cache->jit)
+        jit_flush(cache->jit);
+}
+
+static inline uint32_t block_hash(uint32_t pc)
+{
+    return (pc >> 2) & (BLOCK_HASH_SIZE - 1);
+}
+
+/**
+ * Decode the straight-line run starting at pc into a new block.
+ * Returns NULL if pc is not in RAM or not aligned: the caller then
+ * falls back to single-stepping.
+ */
+static struct block_t *block_translate(struct minirisc_t *minirisc, struct block_cache_t *cache, uint32_t pc)
+{
+    struct platform_t *platform = minirisc->platform;
+    uint32_t size = sizeof(struct block_t) + BLOCK_MAX_INSNS * sizeof(struct insn_t);
+    struct block_t *block;
+    uint32_t instr;
+    uint32_t n = 0;
+
+    if ((pc - RAM_BASE) >= platform->size || (pc & 0x3))
+        return NULL;
+
+    if (cache->arena_used + size > BLOCK_ARENA_SIZE)
+        block_cache_flush(cache);
+
+    block = (struct block_t *)(cache->arena + cache->arena_used);
+    block->pc = pc;
+    block->next[0] = block->next[1] = NULL;
+    block->next_pc[0] = block->next_pc[1] = 0;
+    block->exec_count = 0;
+    block->hits = 0;
+    block->native = NULL;
+
+    platform_mark_code(platform, pc);
+    do
+    {
+        if ((pc - RAM_BASE) >= platform->size)
+            break;
+        if ((pc & PAGE_MASK) == 0)
+            platform_mark_code(platform, pc);
+
+        platform_read(platform, ACCESS_WORD, pc, &instr);
+        minirisc_decode_at(minirisc, pc, instr, &block->insns[n++]);
+        pc += 4;
+    } while (!minirisc_insn_ends_block(&block->insns[n - 1]) && n < BLOCK_MAX_INSNS);
+
+    block->n_insns = n;
+    cache->arena_used += (sizeof(struct block_t) + n * sizeof(struct insn_t) + 7) & ~7;
+
+    block->hash_next = cache->hash[block_hash(block->pc)];
+    cache->hash[block_hash(block->pc)] = block;
+
+    return block;
+}
+
+static struct block_t *block_lookup(struct minirisc_t *minirisc, struct block_cache_t *cache, uint32_t pc)
+{
+    struct block_t *block;
+
+    for (block = cache->hash[block_hash(pc)]; block != NULL; block = block->hash_next)
+    {
+        if (block->pc == pc)
+            return block;
+    }
+
+    return block_translate(minirisc, cache, pc);
+}
+
+/**
+ * Execute the micro-ops of a block. Stops early if the CPU halts or a
+ * store modified translated code. On return PC holds the next address.
+ */
+static void block_exec(struct minirisc_t *minirisc, struct block_cache_t *cache, struct block_t *block)
+{
+    struct insn_t *insn = block->insns;
+    struct insn_t *end = insn + block->n_insns;
+    uint32_t pc = block->pc;
+
+    for (; insn < end; insn++, pc += 4)
+    {
+        minirisc->PC = pc;
+        minirisc->next_PC = pc + 4;
+        insn->exec(minirisc, insn);
+        minirisc->instret++;
+        if (minirisc->halt | cache->dirty)
+            break;
+    }
+    minirisc->PC = minirisc->next_PC;
+}
+
+void block_run(struct minirisc_t *minirisc)
+{
+    struct block_cache_t *cache = minirisc->blocks;
+    struct block_t *block;
+    struct block_t *next;
+    uint32_t generation;
+    uint64_t instret;
+    uint32_t i;
+
+    cache->profile = minirisc->profile;
+    block = block_lookup(minirisc, cache, minirisc->PC);
+
+    while (!minirisc->halt && minirisc->instret < minirisc->max_instret)
+    {
+        if (block == NULL || minirisc->max_instret - minirisc->instret < block->n_insns)
+        {
+            /* Not translatable, or the instruction limit falls inside the block: single-step */
+            minirisc_step(minirisc);
+            if (cache->dirty)
+                block_cache_flush(cache);
+            block = block_lookup(minirisc, cache, minirisc->PC);
+            continue;
+        }
+
+        instret = minirisc->instret;
+        if (block->native)
+        {
+            /* Native code gives back the instructions it skips when leaving early */
+            minirisc->instret += block->n_insns;
+            block->native(minirisc);
+        }
+        else
+        {
+            block_exec(minirisc, cache, block);
+            if (cache->jit && ++block->exec_count == JIT_HOT_THRESHOLD && !cache->dirty)
+                jit_compile(cache->jit, block);
+        }
+
+        if (cache->profile)
+        {
+            /* Count the whole block, minus the instructions skipped by an early exit */
+            block->hits++;
+            for (i = minirisc->instret - instret; i < block->n_insns; i++)
+                profile_add(cache->profile, block->pc + 4 * i, -1);
+        }
+
+        if (cache->dirty)
+        {
+            block_cache_flush(cache);
+            block = block_lookup(minirisc, cache, minirisc->PC);
+            continue;
+        }
+
+        /* Follow the chain if the exit matches a linked successor */
+        if (minirisc->PC == block->next_pc[0] && block->next[0] != NULL)
+        {
+            block = block->next[0];
+            continue;
+        }
+        if (minirisc->PC == block->next_pc[1] && block->next[1] != NULL)
+        {
+            block = block->next[1];
+            continue;
+        }
+
+        generation = cache->generation;
+        next = block_lookup(minirisc, cache, minirisc->PC);
+        if (next == NULL || generation != cache->generation)
+        {
+            /* The arena was just flushed: block is gone, do not link it */
+            block = next;
+            continue;
+        }
+
+        /* Link the successor: fall-through goes in slot 1, anything else in slot 0 */
+        if (minirisc->PC == block->pc + 4 * block->n_insns)
+        {
+            block->next_pc[1] = minirisc->PC;
+            block->next[1] = next;
+        }
+        else
+        {
+            block->next_pc[0] = minirisc->PC;
+            block->next[0] = next;
+        }
+        block = next;
+    }
+
+    if (cache->profile)
+        block_profile_drain(cache);
+}
@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "elf_loader.h"
+#include "callgraph.h"
+
+static void *callgraph_grow(void *array, uint32_t *max, size_t size)
+{
+    *max = *max ? 2 * *max : 1024;
+    if ((array = realloc(array, *max * size)) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return array;
+}
+
+static uint32_t callgraph_add_node(struct callgraph_t *callgraph, uint32_t parent, uint32_t addr)
+{
+    struct callgraph_node_t *node;
+    uint32_t *link;
+
+    if (callgraph->n_nodes == callgraph->max_nodes)
+        callgraph->nodes = callgraph_grow(callgraph->nodes, &callgraph->max_nodes, sizeof(struct callgraph_node_t));
+
+    node = &callgraph->nodes[callgraph->n_nodes];
+    node->addr = addr;
+    node->parent = parent;
+    node->first_child = CALLGRAPH_NONE;
+    node->next_sibling = CALLGRAPH_NONE;
+    node->self = 0;
+    /* Append, so that the tree lists the callees in the order of their first call */
+    if (parent != CALLGRAPH_NONE)
+    {
+        link = &callgraph->nodes[parent].first_child;
+        while (*link != CALLGRAPH_NONE)
+            link = &callgraph->nodes[*link].next_sibling;
+        *link = callgraph->n_nodes;
+    }
+
+    return callgraph->n_nodes++;
+}
+
+struct callgraph_t *callgraph_new(uint32_t entry, uint64_t now)
+{
+    struct callgraph_t *callgraph;
+
+    if ((callgraph = calloc(1, sizeof(struct callgraph_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    callgraph->current = callgraph_add_node(callgraph, CALLGRAPH_NONE, entry);
+    callgraph->last = now;
+
+    return callgraph;
+}
+
+void callgraph_free(struct callgraph_t *callgraph)
+{
+    free(callgraph->nodes);
+    free(callgraph->frames);
+    free(callgraph);
+}
+
+/* Charge the instructions since the last event to the current node */
+static void callgraph_charge(struct callgraph_t *callgraph, uint64_t now)
+{
+    callgraph->nodes[callgraph->current].self += now - callgraph->last;
+    callgraph->last = now;
+}
+
+void callgraph_call(struct callgraph_t *callgraph, uint32_t target, uint32_t return_addr, uint64_t now)
+{
+    struct callgraph_frame_t *frame;
+    uint32_t child;
+
+    callgraph_charge(callgraph, now);
+
+    for (child = callgraph->nodes[callgraph->current].first_child; child != CALLGRAPH_NONE; child = callgraph->nodes[child].next_sibling)
+    {
+        if (callgraph->nodes[child].addr == target)
+            break;
+    }
+    if (child == CALLGRAPH_NONE)
+        child = callgraph_add_node(callgraph, callgraph->current, target);
+
+    if (callgraph->depth == callgraph->max_depth)
+        callgraph->frames = callgraph_grow(callgraph->frames, &callgraph->max_depth, sizeof(struct callgraph_frame_t));
+    frame = &callgraph->frames[callgraph->depth++];
+    frame->node = callgraph->current;
+    frame->return_addr = return_addr;
+
+    callgraph->current = child;
+}
+
+void callgraph_return(struct callgraph_t *callgraph, uint32_t target, uint64_t now)
+{
+    uint32_t depth = callgraph->depth;
+
+    /* Innermost frame returning to target */
+    while (depth > 0 && callgraph->frames[depth - 1].return_addr != target)
+        depth--;
+    if (depth == 0)
+        return;
+
+    callgraph_charge(callgraph, now);
+    callgraph->depth = depth - 1;
+    callgraph->current = callgraph->frames[depth - 1].node;
+}
+
+void callgraph_finish(struct callgraph_t *callgraph, uint64_t now)
+{
+    callgraph_charge(callgraph, now);
+}
+
+static void callgraph_print_name(FILE *fp, struct elf_t *elf, uint32_t addr)
+{
+    const struct elf_symbol_t *sym = elf != NULL ? elf_symbol_at(elf, addr) : NULL;
+
+    if (sym == NULL)
+        fprintf(fp, "0x%08x", addr);
+    else if (sym->addr == addr)
+        fprintf(fp, "%s", sym->name);
+    else
+        fprintf(fp, "%s+0x%x", sym->name, addr - sym->addr);
+}
+
+/* Print the names from the root down to node, separated by ';' */
+static void callgraph_print_path(FILE *fp, struct callgraph_t *callgraph, struct elf_t *elf, uint32_t node, uint32_t *path)
+{
+    uint32_t n = 0;
+
+    for (; node != CALLGRAPH_NONE; node = callgraph->nodes[node].parent)
+        path[n++] = node;
+    while (n-- > 0)
+    {
+        callgraph_print_name(fp, elf, callgraph->nodes[path[n]].addr);
+        if (n > 0)
+            fputc(';', fp);
+    }
+}
+
+int callgraph_write_folded(struct callgraph_t *callgraph, struct elf_t *elf, const char *file_name)
+{
+    uint32_t *path;
+    uint32_t i;
+    FILE *fp;
+
+    if ((fp = fopen(file_name, "w")) == NULL)
+    {
+        perror("Error while opening the folded stacks file");
+        return -1;
+    }
+    if ((path = malloc(callgraph->n_nodes * sizeof(uint32_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < callgraph->n_nodes; i++)
+    {
+        if (callgraph->nodes[i].self == 0)
+            continue;
+        callgraph_print_path(fp, callgraph, elf, i, path);
+        fprintf(fp, " %" PRIu64 "\n", callgraph->nodes[i].self);
+    }
+
+    free(path);
+
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+int callgraph_write_tree(struct callgraph_t *callgraph, struct elf_t *elf, const char *file_name)
+{
+    uint64_t *inclusive;
+    uint32_t node, depth = 0;
+    uint32_t i;
+    FILE *fp;
+
+    if ((fp = fopen(file_name, "w")) == NULL)
+    {
+        perror("Error while opening the call tree file");
+        return -1;
+    }
+    if ((inclusive = malloc(callgraph->n_nodes * sizeof(uint64_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Children come after their parent: one backward pass sums the subtrees */
+    for (i = 0; i < callgraph->n_nodes; i++)
+        inclusive[i] = callgraph->nodes[i].self;
+    for (i = callgraph->n_nodes; i-- > 1;)
+        inclusive[callgraph->nodes[i].parent] += inclusive[i];
+
+    fprintf(fp, "%16s %16s  %s\n", "inclusive", "exclusive", "call path");
+
+    /* Depth-first walk without recursion */
+    node = 0;
+    while (node != CALLGRAPH_NONE)
+    {
+        fprintf(fp, "%16" PRIu64 " %16" PRIu64 "  %*s", inclusive[node], callgraph->nodes[node].self, 2 * depth, "");
+        callgraph_print_name(fp, elf, callgraph->nodes[node].addr);
+        fputc('\n', fp);
+
+        if (callgraph->nodes[node].first_child != CALLGRAPH_NONE)
+        {
+            node = callgraph->nodes[node].first_child;
+            depth++;
+            continue;
+        }
+        while (node != CALLGRAPH_NONE && callgraph->nodes[node].next_sibling == CALLGRAPH_NONE)
+        {
+            node = callgraph->nodes[node].parent;
+            depth--;
+        }
+        if (node != CALLGRAPH_NONE)
+            node = callgraph->nodes[node].next_sibling;
+    }
+
+    free(inclusive);
+
+    return fclose(fp) == 0 ? 0 : -1;
+}
@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "platform.h"
+#include "minirisc.h"
+#include "framebuffer.h"
+#include "dma.h"
+#include "mtimer.h"
+#include "ecall.h"
+#include "checkpoint.h"
+
+/* After types.h: <limits.h> replaces its INT_MAX instead of clashing with it */
+#ifdef MINIRISC_ZLIB
+#include <zlib.h>
+#endif
+
+_Static_assert(sizeof(struct checkpoint_header_t) % 8 == 0, "The page index must stay aligned");
+
+static void checkpoint_error(const char *file_name, const char *msg)
+{
+    printf("Error while restoring %s: %s\n", file_name, msg);
+    exit(EXIT_FAILURE);
+}
+
+static int page_is_zero(const uint8_t *page)
+{
+    const uint64_t *words = (const uint64_t *)page;
+    int i;
+
+    for (i = 0; i < PAGE_SIZE / 8; i++)
+        if (words[i] != 0)
+            return 0;
+
+    return 1;
+}
+
+int checkpoint_write(struct minirisc_t *minirisc, const char *file_name, int compress)
+{
+    struct platform_t *platform = minirisc->platform;
+    uint8_t *ram = (uint8_t *)platform->memory;
+    uint32_t n_pages = platform->size >> PAGE_SHIFT;
+    struct checkpoint_header_t header;
+    struct checkpoint_page_t *index;
+    struct checkpoint_file_t files[ECALL_MAX_FILES];
+    uint64_t offset;
+    uint32_t page, fd, n = 0;
+    int error = 0;
+    FILE *fp;
+#ifdef MINIRISC_ZLIB
+    uint8_t packed[PAGE_SIZE];
+    uLongf packed_size;
+#endif
+
+    if ((fp = fopen(file_name, "wb")) == NULL)
+    {
+        perror("Error while opening the checkpoint file");
+        return -1;
+    }
+    if ((index = malloc(n_pages * sizeof(struct checkpoint_page_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.ram_size = platform->size;
+    header.pc = minirisc->PC;
+    memcpy(header.regs, minirisc->regs, sizeof(header.regs));
+    memcpy(header.fregs, minirisc->fregs, sizeof(header.fregs));
+    header.fcsr = minirisc->fcsr;
+    header.instret = minirisc->instret;
+    header.index_offset = sizeof(header);
+    header.charout_buf = platform->charout_buffer;
+    header.framebuffer.addr = platform->framebuffer->addr;
+    header.framebuffer.width = platform->framebuffer->width;
+    header.framebuffer.height = platform->framebuffer->height;
+    header.dma.src = platform->dma->src;
+    header.dma.dst = platform->dma->dst;
+    header.dma.len = platform->dma->len;
+    if (minirisc->timer != NULL)
+        header.timer_slept = minirisc->timer->slept;
+    if (minirisc->ecall != NULL)
+    {
+        header.brk = minirisc->ecall->brk;
+        for (fd = 3; fd < ECALL_MAX_FILES; fd++)
+        {
+            struct ecall_file_t *file = &minirisc->ecall->files[fd];
+
+            if (file->host_fd == -1)
+                continue;
+            memset(&files[header.n_files], 0, sizeof(files[0]));
+            files[header.n_files].fd = fd;
+            files[header.n_files].flags = file->flags;
+            files[header.n_files].offset = file->offset;
+            strcpy(files[header.n_files].path, file->path);
+            header.n_files++;
+        }
+    }
+
+    for (page = 0; page < n_pages; page++)
+        if (!page_is_zero(ram + ((size_t)page << PAGE_SHIFT)))
+            index[n++].page = page;
+    header.n_pages = n;
+
+    /* File table after the index, then data, raw pages on page boundaries */
+    header.files_offset = header.index_offset + (uint64_t)n * sizeof(struct checkpoint_page_t);
+    offset = header.files_offset + (uint64_t)header.n_files * sizeof(struct checkpoint_file_t);
+    for (page = 0; page < n && !error; page++)
+    {
+        const uint8_t *data = ram + ((size_t)index[page].page << PAGE_SHIFT);
+
+        index[page].size = PAGE_SIZE;
+#ifdef MINIRISC_ZLIB
+        packed_size = sizeof(packed);
+        if (compress && compress2(packed, &packed_size, data, PAGE_SIZE, Z_BEST_SPEED) == Z_OK &&
+            packed_size <= PAGE_SIZE / 2)
+        {
+            index[page].size = packed_size;
+            data = packed;
+        }
+#else
+        (void)compress;
+#endif
+        if (index[page].size == PAGE_SIZE)
+            offset = (offset + PAGE_MASK) & ~(uint64_t)PAGE_MASK;
+        index[page].offset = offset;
+        if (fseeko(fp, offset, SEEK_SET) != 0 || fwrite(data, 1, index[page].size, fp) != index[page].size)
+            error = 1;
+        offset += index[page].size;
+    }
+
+    if (!error && (fseeko(fp, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, fp) != 1 ||
+                   fwrite(index, sizeof(struct checkpoint_page_t), n, fp) != n ||
+                   fwrite(files, sizeof(struct checkpoint_file_t), header.n_files, fp) != header.n_files))
+        error = 1;
+    free(index);
+
+    if (fclose(fp) != 0 || error)
+    {
+        printf("Error while writing the checkpoint file.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+struct checkpoint_t *checkpoint_open(const char *file_name)
+{
+    struct checkpoint_t *checkpoint;
+    struct checkpoint_header_t *header;
+    size_t index_size, files_size;
+    struct stat st;
+    uint32_t i;
+
+    if ((checkpoint = malloc(sizeof(struct checkpoint_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    header = &checkpoint->header;
+
+    if ((checkpoint->fd = open(file_name, O_RDONLY)) == -1 || fstat(checkpoint->fd, &st) == -1)
+    {
+        perror("Error while opening the checkpoint file");
+        exit(EXIT_FAILURE);
+    }
+    if (pread(checkpoint->fd, header, sizeof(*header), 0) != sizeof(*header) ||
+        memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0)
+        checkpoint_error(file_name, "not a checkpoint file");
+    if (header->ram_size == 0 || (header->ram_size & PAGE_MASK) || header->ram_size > PLATFORM_MAX_RAM_SIZE)
+        checkpoint_error(file_name, "invalid RAM size");
+
+    index_size = (size_t)header->n_pages * sizeof(struct checkpoint_page_t);
+    if (header->n_pages > header->ram_size >> PAGE_SHIFT || header->index_offset + index_size > (uint64_t)st.st_size)
+        checkpoint_error(file_name, "corrupted page index");
+    if ((checkpoint->pages = malloc(index_size)) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (pread(checkpoint->fd, checkpoint->pages, index_size, header->index_offset) != (ssize_t)index_size)
+        checkpoint_error(file_name, "corrupted page index");
+
+    files_size = (size_t)header->n_files * sizeof(struct checkpoint_file_t);
+    if (header->n_files > ECALL_MAX_FILES || header->files_offset + files_size > (uint64_t)st.st_size)
+        checkpoint_error(file_name, "corrupted file table");
+    if ((checkpoint->files = malloc(files_size + 1)) == NULL) /* + 1: never malloc(0) */
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (pread(checkpoint->fd, checkpoint->files, files_size, header->files_offset) != (ssize_t)files_size)
+        checkpoint_error(file_name, "corrupted file table");
+    for (i = 0; i < header->n_files; i++)
+        if (memchr(checkpoint->files[i].path, '\0', ECALL_PATH_MAX) == NULL)
+            checkpoint_error(file_name, "corrupted file table");
+
+    for (i = 0; i < header->n_pages; i++)
+    {
+        struct checkpoint_page_t *page = &checkpoint->pages[i];
+
+        if (page->page >= header->ram_size >> PAGE_SHIFT || page->size == 0 || page->size > PAGE_SIZE ||
+            page->offset + page->size > (uint64_t)st.st_size || (page->size == PAGE_SIZE && (page->offset & PAGE_MASK)))
+            checkpoint_error(file_name, "corrupted page index");
+#ifndef MINIRISC_ZLIB
+        if (page->size != PAGE_SIZE)
+            checkpoint_error(file_name, "compressed pages need an emulator built with zlib");
+#endif
+    }
+
+    return checkpoint;
+}
+
+void checkpoint_load(struct checkpoint_t *checkpoint, struct minirisc_t *minirisc)
+{
+    struct checkpoint_header_t *header = &checkpoint->header;
+    uint8_t *ram = (uint8_t *)minirisc->platform->memory;
+    int can_map = sysconf(_SC_PAGESIZE) == PAGE_SIZE;
+    struct checkpoint_page_t *page;
+    uint32_t i, n;
+#ifdef MINIRISC_ZLIB
+    uint8_t packed[PAGE_SIZE];
+    uLongf size;
+#endif
+
+    for (i = 0; i < header->n_pages; i += n)
+    {
+        page = &checkpoint->pages[i];
+        n = 1;
+
+        if (page->size != PAGE_SIZE)
+        {
+#ifdef MINIRISC_ZLIB
+            size = PAGE_SIZE;
+            if (pread(checkpoint->fd, packed, page->size, page->offset) != (ssize_t)page->size ||
+                uncompress(ram + ((size_t)page->page << PAGE_SHIFT), &size, packed, page->size) != Z_OK ||
+                size != PAGE_SIZE)
+            {
+                printf("Error while restoring page %08x of the checkpoint.\n", RAM_BASE + (page->page << PAGE_SHIFT));
+                exit(EXIT_FAILURE);
+            }
+#endif
+            continue;
+        }
+
+        /* Run of raw pages contiguous both in RAM and in the file: one mapping */
+        while (i + n < header->n_pages && page[n].size == PAGE_SIZE && page[n].page == page->page + n &&
+               page[n].offset == page->offset + ((uint64_t)n << PAGE_SHIFT))
+            n++;
+
+        if (can_map)
+        {
+            if (mmap(ram + ((size_t)page->page << PAGE_SHIFT), (size_t)n << PAGE_SHIFT, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_FIXED, checkpoint->fd, page->offset) == MAP_FAILED)
+            {
+                perror("Error while mapping the checkpoint");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (pread(checkpoint->fd, ram + ((size_t)page->page << PAGE_SHIFT), (size_t)n << PAGE_SHIFT,
+                       page->offset) != (ssize_t)n << PAGE_SHIFT)
+        {
+            perror("Error while reading the checkpoint");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memcpy(minirisc->regs, header->regs, sizeof(minirisc->regs));
+    minirisc->regs[0] = 0;
+    memcpy(minirisc->fregs, header->fregs, sizeof(minirisc->fregs));
+    minirisc->fcsr = header->fcsr;
+    minirisc->PC = header->pc;
+    minirisc->instret = header->instret;
+    minirisc->platform->charout_buffer = header->charout_buf;
+    minirisc->platform->framebuffer->addr = header->framebuffer.addr;
+    minirisc->platform->framebuffer->width = header->framebuffer.width;
+    minirisc->platform->framebuffer->height = header->framebuffer.height;
+    minirisc->platform->dma->src = header->dma.src;
+    minirisc->platform->dma->dst = header->dma.dst;
+    minirisc->platform->dma->len = header->dma.len;
+    if (minirisc->timer != NULL)
+        minirisc->timer->slept = header->timer_slept;
+    if (minirisc->ecall != NULL)
+    {
+        minirisc->ecall->brk = header->brk;
+        for (i = 0; i < header->n_files; i++)
+        {
+            struct checkpoint_file_t *file = &checkpoint->files[i];
+
+            if (ecall_restore_file(minirisc->ecall, file->fd, file->flags, file->offset, file->path) == -1)
+            {
+                printf("Error while reopening %s, open in the checkpoint.\n", file->path);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+}
+
+void checkpoint_close(struct checkpoint_t *checkpoint)
+{
+    free(checkpoint->pages);
+    free(checkpoint->files);
+    close(checkpoint->fd);
+    free(checkpoint);
+}
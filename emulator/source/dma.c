@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "types.h"
+#include "platform.h"
+#include "dma.h"
+#include "iothread.h"
+
+static int dma_read(void *opaque, uint32_t offset, enum access_type_t access_type, uint32_t *data)
+{
+    struct dma_t *dma = opaque;
+
+    if (access_type != ACCESS_WORD)
+        return -1;
+
+    switch (offset)
+    {
+    case DMA_SRC:
+        *data = dma->src;
+        break;
+    case DMA_DST:
+        *data = dma->dst;
+        break;
+    case DMA_LEN:
+        *data = dma->len;
+        break;
+    case DMA_MODE:
+        *data = 0;
+        break;
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+static int dma_transfer(struct dma_t *dma, uint32_t mode)
+{
+    const void *src = NULL;
+    void *dst;
+
+    if (dma->len == 0)
+        return 0;
+
+    if ((mode == DMA_COPY && (src = platform_host_range(dma->platform, dma->src, dma->len, 0)) == NULL) ||
+        (dst = platform_host_range(dma->platform, dma->dst, dma->len, 1)) == NULL)
+    {
+        iothread_printf(dma->platform->io, "[ERROR] DMA %s %08x -> %08x (%u bytes) is not in RAM\n",
+                        mode == DMA_COPY ? "copy" : "fill", dma->src, dma->dst, dma->len);
+        return -1;
+    }
+
+    if (mode == DMA_COPY)
+        memmove(dst, src, dma->len);
+    else
+        memset(dst, dma->src & 0xFF, dma->len);
+    dma->transfers++;
+    dma->bytes += dma->len;
+
+    return 0;
+}
+
+static int dma_write(void *opaque, uint32_t offset, enum access_type_t access_type, uint32_t data)
+{
+    struct dma_t *dma = opaque;
+
+    if (access_type != ACCESS_WORD)
+        return -1;
+
+    switch (offset)
+    {
+    case DMA_SRC:
+        dma->src = data;
+        break;
+    case DMA_DST:
+        dma->dst = data;
+        break;
+    case DMA_LEN:
+        dma->len = data;
+        break;
+    case DMA_MODE:
+        if (data != DMA_COPY && data != DMA_FILL)
+            return -1;
+        return dma_transfer(dma, data);
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+struct dma_t *dma_new(struct platform_t *platform)
+{
+    struct dma_t *dma;
+
+    if ((dma = calloc(1, sizeof(struct dma_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    dma->platform = platform;
+    platform_add_device(platform, "dma", DMA_BASE, DMA_SIZE, dma_read, dma_write, dma);
+
+    return dma;
+}
+
+void dma_free(struct dma_t *dma)
+{
+    free(dma);
+}
@@ -0,0 +1,321 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "platform.h"
+#include "minirisc.h"
+#include "mtimer.h"
+#include "ecall.h"
+#include "iothread.h"
+
+/* Guest errno values are newlib's, equal to Linux ones for everything returned here */
+#define ECALL_ERROR(e) (0u - (uint32_t)(e))
+
+static int host_flags(uint32_t flags)
+{
+    int host = 0;
+
+    switch (flags & ECALL_O_ACCMODE)
+    {
+    case 0:
+        host = O_RDONLY;
+        break;
+    case 1:
+        host = O_WRONLY;
+        break;
+    default:
+        host = O_RDWR;
+        break;
+    }
+    if (flags & ECALL_O_APPEND)
+        host |= O_APPEND;
+    if (flags & ECALL_O_CREAT)
+        host |= O_CREAT;
+    if (flags & ECALL_O_TRUNC)
+        host |= O_TRUNC;
+    if (flags & ECALL_O_EXCL)
+        host |= O_EXCL;
+
+    return host;
+}
+
+static struct ecall_file_t *ecall_file(struct ecall_t *ecall, uint32_t fd)
+{
+    if (fd < 3 || fd >= ECALL_MAX_FILES || ecall->files[fd].host_fd == -1)
+        return NULL;
+
+    return &ecall->files[fd];
+}
+
+static uint32_t ecall_open(struct ecall_t *ecall, uint32_t path_addr, uint32_t flags, uint32_t mode)
+{
+    struct platform_t *platform = ecall->minirisc->platform;
+    uint32_t len = ECALL_PATH_MAX;
+    const char *path;
+    uint32_t fd;
+    int host_fd;
+
+    /* The name may end closer to the top of RAM than ECALL_PATH_MAX */
+    if (path_addr - RAM_BASE < platform->size && platform->size - (path_addr - RAM_BASE) < len)
+        len = platform->size - (path_addr - RAM_BASE);
+    if ((path = platform_host_range(platform, path_addr, len, 0)) == NULL)
+        return ECALL_ERROR(EFAULT);
+    if (memchr(path, '\0', len) == NULL)
+        return ECALL_ERROR(ENAMETOOLONG);
+
+    for (fd = 3; fd < ECALL_MAX_FILES && ecall->files[fd].host_fd != -1; fd++)
+        ;
+    if (fd == ECALL_MAX_FILES)
+        return ECALL_ERROR(EMFILE);
+
+    if ((host_fd = open(path, host_flags(flags), mode)) == -1)
+        return ECALL_ERROR(errno);
+
+    ecall->files[fd].host_fd = host_fd;
+    ecall->files[fd].flags = flags & ~(ECALL_O_CREAT | ECALL_O_TRUNC | ECALL_O_EXCL);
+    ecall->files[fd].offset = 0;
+    strcpy(ecall->files[fd].path, path);
+
+    return fd;
+}
+
+static uint32_t ecall_close(struct ecall_t *ecall, uint32_t fd)
+{
+    struct ecall_file_t *file;
+
+    if (fd < 3)
+        return 0;
+    if ((file = ecall_file(ecall, fd)) == NULL)
+        return ECALL_ERROR(EBADF);
+
+    close(file->host_fd);
+    file->host_fd = -1;
+
+    return 0;
+}
+
+static uint32_t ecall_read(struct ecall_t *ecall, uint32_t fd, uint32_t buf, uint32_t len)
+{
+    struct ecall_file_t *file = ecall_file(ecall, fd);
+    void *p;
+    ssize_t n;
+
+    if (fd != 0 && file == NULL)
+        return ECALL_ERROR(EBADF);
+    /* As POSIX: nothing to transfer, the buffer is not checked */
+    if (len == 0)
+        return 0;
+    if ((p = platform_host_range(ecall->minirisc->platform, buf, len, 1)) == NULL)
+        return ECALL_ERROR(EFAULT);
+
+    /* A prompt written just before must be on the terminal */
+    if (fd == 0)
+    {
+        iothread_sync(ecall->minirisc->platform->io);
+        n = read(STDIN_FILENO, p, len);
+    }
+    else if ((n = pread(file->host_fd, p, len, file->offset)) > 0)
+        file->offset += n;
+
+    return n == -1 ? ECALL_ERROR(errno) : (uint32_t)n;
+}
+
+static uint32_t ecall_write(struct ecall_t *ecall, uint32_t fd, uint32_t buf, uint32_t len)
+{
+    struct ecall_file_t *file = ecall_file(ecall, fd);
+    const void *p;
+    ssize_t n;
+
+    if (fd != 1 && fd != 2 && file == NULL)
+        return ECALL_ERROR(EBADF);
+    /* As POSIX: nothing to transfer, the buffer is not checked */
+    if (len == 0)
+        return 0;
+    if ((p = platform_host_range(ecall->minirisc->platform, buf, len, 0)) == NULL)
+        return ECALL_ERROR(EFAULT);
+
+    /* Through the I/O thread, as the charOut output, so that both stay in order */
+    if (fd == 1 || fd == 2)
+    {
+        iothread_write(ecall->minirisc->platform->io, p, len);
+        return len;
+    }
+
+    if (file->flags & ECALL_O_APPEND)
+        n = write(file->host_fd, p, len);
+    else if ((n = pwrite(file->host_fd, p, len, file->offset)) > 0)
+        file->offset += n;
+
+    return n == -1 ? ECALL_ERROR(errno) : (uint32_t)n;
+}
+
+static uint32_t ecall_lseek(struct ecall_t *ecall, uint32_t fd, int32_t offset, uint32_t whence)
+{
+    struct ecall_file_t *file = ecall_file(ecall, fd);
+    struct stat st;
+    int64_t position;
+
+    if (file == NULL)
+        return ECALL_ERROR(fd < 3 ? ESPIPE : EBADF);
+
+    switch (whence)
+    {
+    case SEEK_SET:
+        position = offset;
+        break;
+    case SEEK_CUR:
+        position = (int64_t)file->offset + offset;
+        break;
+    case SEEK_END:
+        if (fstat(file->host_fd, &st) == -1)
+            return ECALL_ERROR(errno);
+        position = (int64_t)st.st_size + offset;
+        break;
+    default:
+        return ECALL_ERROR(EINVAL);
+    }
+    if (position < 0 || position > INT32_MAX)
+        return ECALL_ERROR(EINVAL);
+    file->offset = position;
+
+    return position;
+}
+
+static uint32_t ecall_fstat(struct ecall_t *ecall, uint32_t fd, uint32_t buf)
+{
+    struct ecall_file_t *file = ecall_file(ecall, fd);
+    struct ecall_stat_t result;
+    struct stat st;
+    void *p;
+
+    if (fd >= 3 && file == NULL)
+        return ECALL_ERROR(EBADF);
+    if ((p = platform_host_range(ecall->minirisc->platform, buf, sizeof(result), 1)) == NULL)
+        return ECALL_ERROR(EFAULT);
+
+    if (fd < 3)
+    {
+        result.mode = S_IFCHR | 0620;
+        result.size = 0;
+    }
+    else
+    {
+        if (fstat(file->host_fd, &st) == -1)
+            return ECALL_ERROR(errno);
+        result.mode = st.st_mode;
+        result.size = st.st_size > UINT32_MAX ? UINT32_MAX : st.st_size;
+    }
+    memcpy(p, &result, sizeof(result));
+
+    return 0;
+}
+
+static uint32_t ecall_sbrk(struct ecall_t *ecall, int32_t increment, uint32_t program_end)
+{
+    struct minirisc_t *minirisc = ecall->minirisc;
+    uint32_t brk = ecall->brk != 0 ? ecall->brk : program_end;
+    int64_t end = (int64_t)brk + increment;
+
+    /* Between the program and the stack, with some room for the stack to grow */
+    if (end < RAM_BASE || end + ECALL_STACK_GUARD > minirisc->regs[2])
+        return ECALL_ERROR(ENOMEM);
+    ecall->brk = end;
+
+    return brk;
+}
+
+void ecall_dispatch(struct ecall_t *ecall)
+{
+    struct minirisc_t *minirisc = ecall->minirisc;
+    uint32_t *regs = minirisc->regs;
+    uint64_t now;
+
+    switch (regs[17])
+    {
+    case ECALL_OPEN:
+        regs[10] = ecall_open(ecall, regs[10], regs[11], regs[12]);
+        break;
+    case ECALL_CLOSE:
+        regs[10] = ecall_close(ecall, regs[10]);
+        break;
+    case ECALL_READ:
+        regs[10] = ecall_read(ecall, regs[10], regs[11], regs[12]);
+        break;
+    case ECALL_WRITE:
+        regs[10] = ecall_write(ecall, regs[10], regs[11], regs[12]);
+        break;
+    case ECALL_LSEEK:
+        regs[10] = ecall_lseek(ecall, regs[10], regs[11], regs[12]);
+        break;
+    case ECALL_FSTAT:
+        regs[10] = ecall_fstat(ecall, regs[10], regs[11]);
+        break;
+    case ECALL_GETTIMEOFDAY:
+        now = minirisc->timer != NULL ? mtimer_now(minirisc->timer) : 0;
+        regs[10] = now;
+        regs[11] = now >> 32;
+        break;
+    case ECALL_SBRK:
+        regs[10] = ecall_sbrk(ecall, regs[10], regs[11]);
+        break;
+    case ECALL_EXIT:
+        minirisc->halt = 1;
+        minirisc->exited = 1;
+        minirisc->exit_code = regs[10];
+        break;
+    default:
+        regs[10] = ECALL_ERROR(ENOSYS);
+        break;
+    }
+}
+
+int ecall_restore_file(struct ecall_t *ecall, uint32_t fd, uint32_t flags, uint64_t offset, const char *path)
+{
+    int host_fd;
+
+    if (fd < 3 || fd >= ECALL_MAX_FILES || strlen(path) >= ECALL_PATH_MAX)
+        return -1;
+    if ((host_fd = open(path, host_flags(flags))) == -1)
+        return -1;
+
+    if (ecall->files[fd].host_fd != -1)
+        close(ecall->files[fd].host_fd);
+    ecall->files[fd].host_fd = host_fd;
+    ecall->files[fd].flags = flags;
+    ecall->files[fd].offset = offset;
+    strcpy(ecall->files[fd].path, path);
+
+    return 0;
+}
+
+struct ecall_t *ecall_new(struct minirisc_t *minirisc)
+{
+    struct ecall_t *ecall;
+    int i;
+
+    if ((ecall = calloc(1, sizeof(struct ecall_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    ecall->minirisc = minirisc;
+    for (i = 0; i < ECALL_MAX_FILES; i++)
+        ecall->files[i].host_fd = -1;
+
+    return ecall;
+}
+
+void ecall_free(struct ecall_t *ecall)
+{
+    int i;
+
+    for (i = 3; i < ECALL_MAX_FILES; i++)
+        if (ecall->files[i].host_fd != -1)
+            close(ecall->files[i].host_fd);
+    free(ecall);
+}
@@ -0,0 +1,246 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "platform.h"
+#include "elf_loader.h"
+
+static void elf_error(const char *file_name, const char *msg)
+{
+    printf("Error while loading %s: %s\n", file_name, msg);
+    exit(EXIT_FAILURE);
+}
+
+static int symbol_cmp(const void *a, const void *b)
+{
+    const struct elf_symbol_t *sa = a, *sb = b;
+
+    /* On equal addresses, sized symbols come last so that elf_symbol_at() finds them */
+    if (sa->addr == sb->addr)
+        return (sa->size > sb->size) - (sa->size < sb->size);
+    return (sa->addr > sb->addr) - (sa->addr < sb->addr);
+}
+
+/**
+ * Keep the function symbols (and untyped labels such as _minirisc_init).
+ */
+static void elf_read_symbols(struct elf_t *elf, const char *file_name)
+{
+    Elf32_Ehdr *ehdr = (Elf32_Ehdr *)elf->image;
+    Elf32_Shdr *shdr = (Elf32_Shdr *)(elf->image + ehdr->e_shoff);
+    Elf32_Sym *syms;
+    const char *strtab;
+    uint32_t strtab_size, n, i;
+    int s;
+
+    elf->symbols = NULL;
+    elf->n_symbols = 0;
+
+    if (ehdr->e_shoff == 0 || (size_t)ehdr->e_shoff + (size_t)ehdr->e_shnum * sizeof(Elf32_Shdr) > elf->image_size)
+        return;
+
+    for (s = 0; s < ehdr->e_shnum; s++)
+    {
+        if (shdr[s].sh_type != SHT_SYMTAB)
+            continue;
+        if (shdr[s].sh_link >= ehdr->e_shnum ||
+            (size_t)shdr[s].sh_offset + shdr[s].sh_size > elf->image_size ||
+            (size_t)shdr[shdr[s].sh_link].sh_offset + shdr[shdr[s].sh_link].sh_size > elf->image_size)
+            elf_error(file_name, "corrupted symbol table");
+
+        syms = (Elf32_Sym *)(elf->image + shdr[s].sh_offset);
+        n = shdr[s].sh_size / sizeof(Elf32_Sym);
+        strtab = (const char *)elf->image + shdr[shdr[s].sh_link].sh_offset;
+        strtab_size = shdr[shdr[s].sh_link].sh_size;
+
+        /* An empty table: no symbols, and never malloc(0) */
+        if (n == 0)
+            return;
+        if ((elf->symbols = malloc(n * sizeof(struct elf_symbol_t))) == NULL)
+        {
+            printf("Malloc error.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            if (ELF32_ST_TYPE(syms[i].st_info) != STT_FUNC && ELF32_ST_TYPE(syms[i].st_info) != STT_NOTYPE)
+                continue;
+            if (syms[i].st_shndx == SHN_UNDEF || syms[i].st_shndx >= SHN_LORESERVE)
+                continue;
+            if (syms[i].st_name == 0 || syms[i].st_name >= strtab_size)
+                continue;
+            elf->symbols[elf->n_symbols].name = strtab + syms[i].st_name;
+            elf->symbols[elf->n_symbols].addr = syms[i].st_value;
+            elf->symbols[elf->n_symbols].size = syms[i].st_size;
+            elf->n_symbols++;
+        }
+        qsort(elf->symbols, elf->n_symbols, sizeof(struct elf_symbol_t), symbol_cmp);
+        return;
+    }
+}
+
+struct elf_t *elf_open(const char *file_name)
+{
+    struct elf_t *elf;
+    struct stat st;
+    Elf32_Ehdr *ehdr;
+    int fd;
+
+    if ((fd = open(file_name, O_RDONLY)) == -1 || fstat(fd, &st) == -1)
+    {
+        perror("Error while opening the program file");
+        exit(EXIT_FAILURE);
+    }
+
+    if ((size_t)st.st_size < sizeof(Elf32_Ehdr))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    if ((elf = malloc(sizeof(struct elf_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    elf->fd = fd;
+    elf->image_size = st.st_size;
+    if ((elf->image = mmap(NULL, elf->image_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+        perror("Error while mapping the program file");
+        exit(EXIT_FAILURE);
+    }
+
+    ehdr = (Elf32_Ehdr *)elf->image;
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0)
+    {
+        munmap(elf->image, elf->image_size);
+        close(fd);
+        free(elf);
+        return NULL;
+    }
+
+    if (ehdr->e_ident[EI_CLASS] != ELFCLASS32 || ehdr->e_ident[EI_DATA] != ELFDATA2LSB)
+        elf_error(file_name, "not a 32-bit little-endian ELF file");
+    if (ehdr->e_type != ET_EXEC || ehdr->e_machine != EM_RISCV)
+        elf_error(file_name, "not a RISC-V executable");
+    if ((size_t)ehdr->e_phoff + (size_t)ehdr->e_phnum * sizeof(Elf32_Phdr) > elf->image_size)
+        elf_error(file_name, "corrupted program headers");
+
+    elf->entry = ehdr->e_entry;
+    elf_read_symbols(elf, file_name);
+
+    return elf;
+}
+
+void elf_close(struct elf_t *elf)
+{
+    free(elf->symbols);
+    munmap(elf->image, elf->image_size);
+    close(elf->fd);
+    free(elf);
+}
+
+void elf_load(struct elf_t *elf, struct platform_t *platform)
+{
+    Elf32_Ehdr *ehdr = (Elf32_Ehdr *)elf->image;
+    Elf32_Phdr *phdr = (Elf32_Phdr *)(elf->image + ehdr->e_phoff);
+    int can_map = sysconf(_SC_PAGESIZE) == PAGE_SIZE;
+    uint8_t *ram = (uint8_t *)platform->memory;
+    uint32_t offset, file_end, mem_end, start, end;
+    int i;
+
+    for (i = 0; i < ehdr->e_phnum; i++)
+    {
+        if (phdr[i].p_type != PT_LOAD || phdr[i].p_memsz == 0)
+            continue;
+
+        offset = phdr[i].p_vaddr - RAM_BASE;
+        if (phdr[i].p_vaddr < RAM_BASE || offset > platform->size || phdr[i].p_memsz > platform->size - offset ||
+            phdr[i].p_filesz > phdr[i].p_memsz || (size_t)phdr[i].p_offset + phdr[i].p_filesz > elf->image_size)
+        {
+            printf("Segment %d (%08x - %08x) does not fit in RAM (%08x - %08x)\n", i, phdr[i].p_vaddr,
+                   phdr[i].p_vaddr + phdr[i].p_memsz - 1, RAM_BASE, RAM_BASE + platform->size - 1);
+            exit(EXIT_FAILURE);
+        }
+        file_end = offset + phdr[i].p_filesz;
+        mem_end = offset + phdr[i].p_memsz;
+
+        /* File part: whole pages are mapped from the file, edges are copied */
+        start = (offset + PAGE_MASK) & ~PAGE_MASK;
+        end = file_end & ~PAGE_MASK;
+        if (can_map && ((phdr[i].p_offset - offset) & PAGE_MASK) == 0 && start < end)
+        {
+            if (mmap(ram + start, end - start, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                     elf->fd, phdr[i].p_offset + (start - offset)) == MAP_FAILED)
+            {
+                perror("Error while mapping a segment");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(ram + offset, elf->image + phdr[i].p_offset, start - offset);
+            memcpy(ram + end, elf->image + phdr[i].p_offset + (end - offset), file_end - end);
+        }
+        else
+            memcpy(ram + offset, elf->image + phdr[i].p_offset, phdr[i].p_filesz);
+
+        /* .bss: whole pages are replaced by fresh zero pages, edges are cleared */
+        start = (file_end + PAGE_MASK) & ~PAGE_MASK;
+        end = mem_end & ~PAGE_MASK;
+        if (can_map && start < end)
+        {
+            if (mmap(ram + start, end - start, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS,
+                     -1, 0) == MAP_FAILED)
+            {
+                perror("Error while mapping .bss");
+                exit(EXIT_FAILURE);
+            }
+            memset(ram + file_end, 0, start - file_end);
+            memset(ram + end, 0, mem_end - end);
+        }
+        else
+            memset(ram + file_end, 0, mem_end - file_end);
+    }
+}
+
+const struct elf_symbol_t *elf_symbol_at(struct elf_t *elf, uint32_t addr)
+{
+    uint32_t lo = 0, hi = elf->n_symbols;
+    const struct elf_symbol_t *sym;
+
+    /* Last symbol starting at or below addr */
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+
+        if (elf->symbols[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+
+    sym = &elf->symbols[lo - 1];
+    if (sym->size != 0 && addr - sym->addr >= sym->size)
+        return NULL;
+
+    return sym;
+}
+
+const struct elf_symbol_t *elf_symbol_by_name(struct elf_t *elf, const char *name)
+{
+    uint32_t i;
+
+    for (i = 0; i < elf->n_symbols; i++)
+        if (strcmp(elf->symbols[i].name, name) == 0)
+            return &elf->symbols[i];
+
+    return NULL;
+}
@@ -0,0 +1,689 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fenv.h>
+
+#include "types.h"
+#include "platform.h"
+#include "minirisc.h"
+#include "iothread.h"
+#include "fpu.h"
+
+/*
+ * F / D instructions run on the host FPU: the host rounding mode follows
+ * the instruction's and the host exception flags are accrued into
+ * fcsr.fflags. The host stays in round-to-nearest between instructions.
+ * What IEEE 754 leaves open is done the RISC-V way here: NaN-boxed
+ * singles, canonical NaN results, saturating conversions to integers,
+ * min / max and comparisons. The host has no ties-away rounding: RMM is
+ * only accepted where the result does not depend on the host, conversions
+ * to integers and exact conversions. Elsewhere it halts the CPU rather
+ * than round ties to even.
+ */
+
+#define CANONICAL_NAN_S 0x7FC00000u
+#define CANONICAL_NAN_D 0x7FF8000000000000ull
+#define BOX_S 0xFFFFFFFF00000000ull
+#define SIGN_S 0x80000000u
+#define SIGN_D 0x8000000000000000ull
+
+/* ------------------------------------------------------------------------- */
+/* Registers                                                                  */
+/* ------------------------------------------------------------------------- */
+
+static inline float bits_to_s(uint32_t bits)
+{
+    float value;
+
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline double bits_to_d(uint64_t bits)
+{
+    double value;
+
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* A single that is not NaN-boxed reads as the canonical NaN */
+static inline uint32_t get_s_bits(struct minirisc_t *minirisc, int reg)
+{
+    uint64_t value = minirisc->fregs[reg];
+
+    return (value & BOX_S) == BOX_S ? (uint32_t)value : CANONICAL_NAN_S;
+}
+
+static inline void set_s_bits(struct minirisc_t *minirisc, int reg, uint32_t bits)
+{
+    minirisc->fregs[reg] = BOX_S | bits;
+}
+
+static inline float get_s(struct minirisc_t *minirisc, int reg)
+{
+    return bits_to_s(get_s_bits(minirisc, reg));
+}
+
+static inline double get_d(struct minirisc_t *minirisc, int reg)
+{
+    return bits_to_d(minirisc->fregs[reg]);
+}
+
+/* Arithmetic results: any NaN becomes the canonical one */
+
+static inline void set_s(struct minirisc_t *minirisc, int reg, float value)
+{
+    uint32_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    set_s_bits(minirisc, reg, isnan(value) ? CANONICAL_NAN_S : bits);
+}
+
+static inline void set_d(struct minirisc_t *minirisc, int reg, double value)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    minirisc->fregs[reg] = isnan(value) ? CANONICAL_NAN_D : bits;
+}
+
+static inline int is_snan_s(uint32_t bits)
+{
+    return (bits & 0x7F800000u) == 0x7F800000u && (bits & 0x007FFFFFu) != 0 && (bits & 0x00400000u) == 0;
+}
+
+static inline int is_snan_d(uint64_t bits)
+{
+    return (bits & 0x7FF0000000000000ull) == 0x7FF0000000000000ull && (bits & 0x000FFFFFFFFFFFFFull) != 0 &&
+           (bits & 0x0008000000000000ull) == 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Rounding modes and exception flags                                         */
+/* ------------------------------------------------------------------------- */
+
+static const int host_rounding[] = {
+    [FPU_RNE] = FE_TONEAREST,
+    [FPU_RTZ] = FE_TOWARDZERO,
+    [FPU_RDN] = FE_DOWNWARD,
+    [FPU_RUP] = FE_UPWARD,
+};
+
+/**
+ * Rounding mode of insn, fcsr.frm for FPU_DYN.
+ * @return -1 for a reserved mode: the CPU halts, as on an unknown instruction
+ */
+static int fpu_rm(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    int rm = insn->rd2 & 0x7;
+
+    if (rm == FPU_DYN)
+        rm = (minirisc->fcsr >> FPU_FRM_SHIFT) & 0x7;
+    if (rm <= FPU_RMM)
+        return rm;
+
+    iothread_printf(minirisc->platform->io, "Invalid rounding mode %d at PC %08x (instruction %08x)\n", rm,
+                    minirisc->PC, insn->raw);
+    minirisc->halt = 1;
+    return -1;
+}
+
+/**
+ * Before a rounded operation: switch the host to its rounding mode
+ * and clear the host exception flags. An exact operation runs in
+ * round-to-nearest whatever its mode.
+ * @return the rounding mode, -1 if it is reserved or RMM (the CPU halts)
+ */
+static int fpu_enter(struct minirisc_t *minirisc, struct insn_t *insn, int exact)
+{
+    int rm = fpu_rm(minirisc, insn);
+
+    if (rm == -1)
+        return -1;
+    if (exact)
+        rm = FPU_RNE;
+    else if (rm == FPU_RMM)
+    {
+        iothread_printf(minirisc->platform->io, "Unsupported rounding mode RMM at PC %08x (instruction %08x)\n",
+                        minirisc->PC, insn->raw);
+        minirisc->halt = 1;
+        return -1;
+    }
+    if (host_rounding[rm] != FE_TONEAREST)
+        fesetround(host_rounding[rm]);
+    feclearexcept(FE_ALL_EXCEPT);
+
+    return rm;
+}
+
+/**
+ * After a rounded operation: accrue the host exception flags
+ * and go back to round-to-nearest.
+ */
+static void fpu_leave(struct minirisc_t *minirisc, int rm)
+{
+    int raised = fetestexcept(FE_ALL_EXCEPT);
+
+    if (host_rounding[rm] != FE_TONEAREST)
+        fesetround(FE_TONEAREST);
+    if (raised)
+        minirisc->fcsr |= ((raised & FE_INEXACT) ? FPU_NX : 0) | ((raised & FE_UNDERFLOW) ? FPU_UF : 0) |
+                          ((raised & FE_OVERFLOW) ? FPU_OF : 0) | ((raised & FE_DIVBYZERO) ? FPU_DZ : 0) |
+                          ((raised & FE_INVALID) ? FPU_NV : 0);
+}
+
+/*
+ * Rounded operations, exact if the result never needs rounding. The
+ * operands are read after fpu_enter() and the result written before
+ * fpu_leave(): the compiler cannot move the arithmetic out of the host
+ * rounding mode.
+ */
+#define FPU_OP(name, exact, statement)                                            \
+    static void exec_##name(struct minirisc_t *minirisc, struct insn_t *insn)     \
+    {                                                                             \
+        int rm;                                                                   \
+                                                                                  \
+        if ((rm = fpu_enter(minirisc, insn, exact)) == -1)                        \
+            return;                                                               \
+        statement;                                                                \
+        fpu_leave(minirisc, rm);                                                  \
+    }
+
+#define S(field) get_s(minirisc, insn->field)
+#define D(field) get_d(minirisc, insn->field)
+#define X(field) minirisc->regs[insn->field]
+
+FPU_OP(fadd_s, 0, set_s(minirisc, insn->rd, S(rs1) + S(rs2)))
+FPU_OP(fsub_s, 0, set_s(minirisc, insn->rd, S(rs1) - S(rs2)))
+FPU_OP(fmul_s, 0, set_s(minirisc, insn->rd, S(rs1) * S(rs2)))
+FPU_OP(fdiv_s, 0, set_s(minirisc, insn->rd, S(rs1) / S(rs2)))
+FPU_OP(fsqrt_s, 0, set_s(minirisc, insn->rd, sqrtf(S(rs1))))
+FPU_OP(fmadd_s, 0, set_s(minirisc, insn->rd, fmaf(S(rs1), S(rs2), S(rs3))))
+FPU_OP(fmsub_s, 0, set_s(minirisc, insn->rd, fmaf(S(rs1), S(rs2), -S(rs3))))
+FPU_OP(fnmsub_s, 0, set_s(minirisc, insn->rd, fmaf(-S(rs1), S(rs2), S(rs3))))
+FPU_OP(fnmadd_s, 0, set_s(minirisc, insn->rd, fmaf(-S(rs1), S(rs2), -S(rs3))))
+
+FPU_OP(fadd_d, 0, set_d(minirisc, insn->rd, D(rs1) + D(rs2)))
+FPU_OP(fsub_d, 0, set_d(minirisc, insn->rd, D(rs1) - D(rs2)))
+FPU_OP(fmul_d, 0, set_d(minirisc, insn->rd, D(rs1) * D(rs2)))
+FPU_OP(fdiv_d, 0, set_d(minirisc, insn->rd, D(rs1) / D(rs2)))
+FPU_OP(fsqrt_d, 0, set_d(minirisc, insn->rd, sqrt(D(rs1))))
+FPU_OP(fmadd_d, 0, set_d(minirisc, insn->rd, fma(D(rs1), D(rs2), D(rs3))))
+FPU_OP(fmsub_d, 0, set_d(minirisc, insn->rd, fma(D(rs1), D(rs2), -D(rs3))))
+FPU_OP(fnmsub_d, 0, set_d(minirisc, insn->rd, fma(-D(rs1), D(rs2), D(rs3))))
+FPU_OP(fnmadd_d, 0, set_d(minirisc, insn->rd, fma(-D(rs1), D(rs2), -D(rs3))))
+
+FPU_OP(fcvt_s_w, 0, set_s(minirisc, insn->rd, (float)(int32_t)X(rs1)))
+FPU_OP(fcvt_s_wu, 0, set_s(minirisc, insn->rd, (float)X(rs1)))
+FPU_OP(fcvt_d_w, 1, set_d(minirisc, insn->rd, (int32_t)X(rs1)))
+FPU_OP(fcvt_d_wu, 1, set_d(minirisc, insn->rd, X(rs1)))
+FPU_OP(fcvt_s_d, 0, set_s(minirisc, insn->rd, (float)D(rs1)))
+FPU_OP(fcvt_d_s, 1, set_d(minirisc, insn->rd, S(rs1)))
+
+/* ------------------------------------------------------------------------- */
+/* Conversions to integers                                                    */
+/* ------------------------------------------------------------------------- */
+
+static double round_rm(double value, int rm)
+{
+    switch (rm)
+    {
+    case FPU_RTZ:
+        return trunc(value);
+    case FPU_RDN:
+        return floor(value);
+    case FPU_RUP:
+        return ceil(value);
+    case FPU_RMM:
+        return round(value);
+    default:
+        return nearbyint(value); /* The host is in round-to-nearest */
+    }
+}
+
+/**
+ * Round value (a single or a double, exact as a double) to an integer in
+ * rd. Out of range values and NaN saturate and raise NV.
+ */
+static void fcvt_int(struct minirisc_t *minirisc, struct insn_t *insn, double value, int is_unsigned)
+{
+    int rm = fpu_rm(minirisc, insn);
+    double low = is_unsigned ? 0.0 : (double)INT32_MIN;
+    double high = is_unsigned ? (double)UINT32_MAX : (double)INT32_MAX;
+    double rounded;
+    uint32_t result;
+
+    if (rm == -1)
+        return;
+    rounded = round_rm(value, rm);
+
+    if (isnan(value) || rounded > high)
+    {
+        minirisc->fcsr |= FPU_NV;
+        result = is_unsigned ? UINT32_MAX : INT32_MAX;
+    }
+    else if (rounded < low)
+    {
+        minirisc->fcsr |= FPU_NV;
+        result = is_unsigned ? 0 : (uint32_t)INT32_MIN;
+    }
+    else
+    {
+        result = is_unsigned ? (uint32_t)rounded : (uint32_t)(int32_t)rounded;
+        if (rounded != value)
+            minirisc->fcsr |= FPU_NX;
+    }
+    set_reg(minirisc, insn->rd, result);
+}
+
+static void exec_fcvt_w_s(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    fcvt_int(minirisc, insn, S(rs1), 0);
+}
+
+static void exec_fcvt_wu_s(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    fcvt_int(minirisc, insn, S(rs1), 1);
+}
+
+static void exec_fcvt_w_d(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    fcvt_int(minirisc, insn, D(rs1), 0);
+}
+
+static void exec_fcvt_wu_d(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    fcvt_int(minirisc, insn, D(rs1), 1);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Sign injection, moves, min / max, comparisons, classification             */
+/* ------------------------------------------------------------------------- */
+
+static void exec_fsgnj_s(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_s_bits(minirisc, insn->rd,
+               (get_s_bits(minirisc, insn->rs1) & ~SIGN_S) | (get_s_bits(minirisc, insn->rs2) & SIGN_S));
+}
+
+static void exec_fsgnjn_s(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_s_bits(minirisc, insn->rd,
+               (get_s_bits(minirisc, insn->rs1) & ~SIGN_S) | (~get_s_bits(minirisc, insn->rs2) & SIGN_S));
+}
+
+static void exec_fsgnjx_s(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_s_bits(minirisc, insn->rd, get_s_bits(minirisc, insn->rs1) ^ (get_s_bits(minirisc, insn->rs2) & SIGN_S));
+}
+
+static void exec_fsgnj_d(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    minirisc->fregs[insn->rd] = (minirisc->fregs[insn->rs1] & ~SIGN_D) | (minirisc->fregs[insn->rs2] & SIGN_D);
+}
+
+static void exec_fsgnjn_d(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    minirisc->fregs[insn->rd] = (minirisc->fregs[insn->rs1] & ~SIGN_D) | (~minirisc->fregs[insn->rs2] & SIGN_D);
+}
+
+static void exec_fsgnjx_d(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    minirisc->fregs[insn->rd] = minirisc->fregs[insn->rs1] ^ (minirisc->fregs[insn->rs2] & SIGN_D);
+}
+
+static void exec_fmv_x_w(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, (uint32_t)minirisc->fregs[insn->rs1]);
+}
+
+static void exec_fmv_w_x(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_s_bits(minirisc, insn->rd, X(rs1));
+}
+
+/**
+ * A NaN operand gives the other one, -0 is below +0.
+ */
+static void fminmax_s(struct minirisc_t *minirisc, struct insn_t *insn, int max)
+{
+    uint32_t a = get_s_bits(minirisc, insn->rs1);
+    uint32_t b = get_s_bits(minirisc, insn->rs2);
+
+    if (is_snan_s(a) || is_snan_s(b))
+        minirisc->fcsr |= FPU_NV;
+    if (isnan(bits_to_s(a)) && isnan(bits_to_s(b)))
+        set_s_bits(minirisc, insn->rd, CANONICAL_NAN_S);
+    else if (isnan(bits_to_s(a)))
+        set_s_bits(minirisc, insn->rd, b);
+    else if (isnan(bits_to_s(b)))
+        set_s_bits(minirisc, insn->rd, a);
+    else if (bits_to_s(a) == bits_to_s(b))
+        set_s_bits(minirisc, insn->rd, max ? a & b : a | b);
+    else
+        set_s_bits(minirisc, insn->rd, (bits_to_s(a) < bits_to_s(b)) != max ? a : b);
+}
+
+static void fminmax_d(struct minirisc_t *minirisc, struct insn_t *insn, int max)
+{
+    uint64_t a = minirisc->fregs[insn->rs1];
+    uint64_t b = minirisc->fregs[insn->rs2];
+
+    if (is_snan_d(a) || is_snan_d(b))
+        minirisc->fcsr |= FPU_NV;
+    if (isnan(bits_to_d(a)) && isnan(bits_to_d(b)))
+        minirisc->fregs[insn->rd] = CANONICAL_NAN_D;
+    else if (isnan(bits_to_d(a)))
+        minirisc->fregs[insn->rd] = b;
+    else if (isnan(bits_to_d(b)))
+        minirisc->fregs[insn->rd] = a;
+    else if (bits_to_d(a) == bits_to_d(b))
+        minirisc->fregs[insn->rd] = max ? a & b : a | b;
+    else
+        minirisc->fregs[insn->rd] = (bits_to_d(a) < bits_to_d(b)) != max ? a : b;
+}
+
+static void exec_fmin_s(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    fminmax_s(minirisc, insn, 0);
+}
+
+static void exec_fmax_s(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    fminmax_s(minirisc, insn, 1);
+}
+
+static void exec_fmin_d(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    fminmax_d(minirisc, insn, 0);
+}
+
+static void exec_fmax_d(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    fminmax_d(minirisc, insn, 1);
+}
+
+/* FEQ is quiet (NV on signaling NaNs only), FLT and FLE raise NV on any NaN */
+
+static void exec_feq_s(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t a = get_s_bits(minirisc, insn->rs1);
+    uint32_t b = get_s_bits(minirisc, insn->rs2);
+
+    if (is_snan_s(a) || is_snan_s(b))
+        minirisc->fcsr |= FPU_NV;
+    set_reg(minirisc, insn->rd, bits_to_s(a) == bits_to_s(b));
+}
+
+static void exec_flt_s(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    if (isnan(S(rs1)) || isnan(S(rs2)))
+        minirisc->fcsr |= FPU_NV;
+    set_reg(minirisc, insn->rd, isless(S(rs1), S(rs2)));
+}
+
+static void exec_fle_s(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    if (isnan(S(rs1)) || isnan(S(rs2)))
+        minirisc->fcsr |= FPU_NV;
+    set_reg(minirisc, insn->rd, islessequal(S(rs1), S(rs2)));
+}
+
+static void exec_feq_d(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    if (is_snan_d(minirisc->fregs[insn->rs1]) || is_snan_d(minirisc->fregs[insn->rs2]))
+        minirisc->fcsr |= FPU_NV;
+    set_reg(minirisc, insn->rd, D(rs1) == D(rs2));
+}
+
+static void exec_flt_d(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    if (isnan(D(rs1)) || isnan(D(rs2)))
+        minirisc->fcsr |= FPU_NV;
+    set_reg(minirisc, insn->rd, isless(D(rs1), D(rs2)));
+}
+
+static void exec_fle_d(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    if (isnan(D(rs1)) || isnan(D(rs2)))
+        minirisc->fcsr |= FPU_NV;
+    set_reg(minirisc, insn->rd, islessequal(D(rs1), D(rs2)));
+}
+
+/**
+ * FCLASS bit of a value of class (fpclassify()), sign and signaling flag.
+ */
+static uint32_t fpu_class(int class, int negative, int snan)
+{
+    switch (class)
+    {
+    case FP_INFINITE:
+        return negative ? 1 << 0 : 1 << 7;
+    case FP_NORMAL:
+        return negative ? 1 << 1 : 1 << 6;
+    case FP_SUBNORMAL:
+        return negative ? 1 << 2 : 1 << 5;
+    case FP_ZERO:
+        return negative ? 1 << 3 : 1 << 4;
+    default:
+        return snan ? 1 << 8 : 1 << 9;
+    }
+}
+
+static void exec_fclass_s(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t bits = get_s_bits(minirisc, insn->rs1);
+
+    set_reg(minirisc, insn->rd, fpu_class(fpclassify(bits_to_s(bits)), (bits & SIGN_S) != 0, is_snan_s(bits)));
+}
+
+static void exec_fclass_d(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint64_t bits = minirisc->fregs[insn->rs1];
+
+    set_reg(minirisc, insn->rd, fpu_class(fpclassify(bits_to_d(bits)), (bits & SIGN_D) != 0, is_snan_d(bits)));
+}
+
+/* ------------------------------------------------------------------------- */
+/* Loads and stores: doubles are two word accesses, low word first          */
+/* ------------------------------------------------------------------------- */
+
+static void exec_flw(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t data;
+
+    if (minirisc_load(minirisc, ACCESS_WORD, X(rs1) + insn->imm, &data) == -1)
+    {
+        minirisc->halt = 1;
+        return;
+    }
+    set_s_bits(minirisc, insn->rd, data);
+}
+
+static void exec_fld(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t addr = X(rs1) + insn->imm;
+    uint32_t low, high;
+
+    if (minirisc_load(minirisc, ACCESS_WORD, addr, &low) == -1 ||
+        minirisc_load(minirisc, ACCESS_WORD, addr + 4, &high) == -1)
+    {
+        minirisc->halt = 1;
+        return;
+    }
+    minirisc->fregs[insn->rd] = (uint64_t)high << 32 | low;
+}
+
+static void exec_fsw(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    if (minirisc_store(minirisc, ACCESS_WORD, X(rs1) + insn->imm, (uint32_t)minirisc->fregs[insn->rd]) == -1)
+        minirisc->halt = 1;
+}
+
+static void exec_fsd(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t addr = X(rs1) + insn->imm;
+    uint64_t value = minirisc->fregs[insn->rd];
+
+    if (minirisc_store(minirisc, ACCESS_WORD, addr, (uint32_t)value) == -1 ||
+        minirisc_store(minirisc, ACCESS_WORD, addr + 4, (uint32_t)(value >> 32)) == -1)
+        minirisc->halt = 1;
+}
+
+/* ------------------------------------------------------------------------- */
+/* fcsr                                                                       */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * rd = csr, then csr = rs1 (FCSRRW), csr | rs1 (FCSRRS) or csr & ~rs1 (FCSRRC).
+ */
+static void fcsr_access(struct minirisc_t *minirisc, struct insn_t *insn, int opcode)
+{
+    uint32_t csr = insn->imm & 0xFFF;
+    uint32_t value = X(rs1);
+    uint32_t old;
+
+    switch (csr)
+    {
+    case FPU_CSR_FFLAGS:
+        old = minirisc->fcsr & FPU_FLAGS;
+        break;
+    case FPU_CSR_FRM:
+        old = (minirisc->fcsr >> FPU_FRM_SHIFT) & 0x7;
+        break;
+    case FPU_CSR_FCSR:
+        old = minirisc->fcsr & 0xFF;
+        break;
+    default:
+        iothread_printf(minirisc->platform->io, "Unknown floating-point CSR %03x at PC %08x\n", csr, minirisc->PC);
+        minirisc->halt = 1;
+        return;
+    }
+
+    if (opcode == FCSRRS_CODE)
+        value = old | value;
+    else if (opcode == FCSRRC_CODE)
+        value = old & ~value;
+
+    switch (csr)
+    {
+    case FPU_CSR_FFLAGS:
+        minirisc->fcsr = (minirisc->fcsr & ~FPU_FLAGS) | (value & FPU_FLAGS);
+        break;
+    case FPU_CSR_FRM:
+        minirisc->fcsr = (minirisc->fcsr & FPU_FLAGS) | (value & 0x7) << FPU_FRM_SHIFT;
+        break;
+    default:
+        minirisc->fcsr = value & 0xFF;
+        break;
+    }
+    set_reg(minirisc, insn->rd, old);
+}
+
+static void exec_fcsrrw(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    fcsr_access(minirisc, insn, FCSRRW_CODE);
+}
+
+static void exec_fcsrrs(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    fcsr_access(minirisc, insn, FCSRRS_CODE);
+}
+
+static void exec_fcsrrc(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    fcsr_access(minirisc, insn, FCSRRC_CODE);
+}
+
+#undef S
+#undef D
+#undef X
+#undef FPU_OP
+
+/* ------------------------------------------------------------------------- */
+/* Decoder                                                                    */
+/* ------------------------------------------------------------------------- */
+
+struct fpu_desc_t
+{
+    insn_exec_t exec;
+    int imm; /* imm[11:0] sign-extended (loads, stores, CSR number) */
+};
+
+static const struct fpu_desc_t fpu_table[128] = {
+    [FLW_CODE] = {exec_flw, 1},
+    [FSW_CODE] = {exec_fsw, 1},
+    [FLD_CODE] = {exec_fld, 1},
+    [FSD_CODE] = {exec_fsd, 1},
+    [FMADD_S_CODE] = {exec_fmadd_s, 0},
+    [FMSUB_S_CODE] = {exec_fmsub_s, 0},
+    [FNMSUB_S_CODE] = {exec_fnmsub_s, 0},
+    [FNMADD_S_CODE] = {exec_fnmadd_s, 0},
+    [FMADD_D_CODE] = {exec_fmadd_d, 0},
+    [FMSUB_D_CODE] = {exec_fmsub_d, 0},
+    [FNMSUB_D_CODE] = {exec_fnmsub_d, 0},
+    [FNMADD_D_CODE] = {exec_fnmadd_d, 0},
+    [FCSRRW_CODE] = {exec_fcsrrw, 1},
+    [FCSRRS_CODE] = {exec_fcsrrs, 1},
+    [FCSRRC_CODE] = {exec_fcsrrc, 1},
+    [FADD_S_CODE] = {exec_fadd_s, 0},
+    [FSUB_S_CODE] = {exec_fsub_s, 0},
+    [FMUL_S_CODE] = {exec_fmul_s, 0},
+    [FDIV_S_CODE] = {exec_fdiv_s, 0},
+    [FSQRT_S_CODE] = {exec_fsqrt_s, 0},
+    [FSGNJ_S_CODE] = {exec_fsgnj_s, 0},
+    [FSGNJN_S_CODE] = {exec_fsgnjn_s, 0},
+    [FSGNJX_S_CODE] = {exec_fsgnjx_s, 0},
+    [FMIN_S_CODE] = {exec_fmin_s, 0},
+    [FMAX_S_CODE] = {exec_fmax_s, 0},
+    [FCVT_W_S_CODE] = {exec_fcvt_w_s, 0},
+    [FCVT_WU_S_CODE] = {exec_fcvt_wu_s, 0},
+    [FMV_X_W_CODE] = {exec_fmv_x_w, 0},
+    [FEQ_S_CODE] = {exec_feq_s, 0},
+    [FLT_S_CODE] = {exec_flt_s, 0},
+    [FLE_S_CODE] = {exec_fle_s, 0},
+    [FCLASS_S_CODE] = {exec_fclass_s, 0},
+    [FCVT_S_W_CODE] = {exec_fcvt_s_w, 0},
+    [FCVT_S_WU_CODE] = {exec_fcvt_s_wu, 0},
+    [FMV_W_X_CODE] = {exec_fmv_w_x, 0},
+    [FADD_D_CODE] = {exec_fadd_d, 0},
+    [FSUB_D_CODE] = {exec_fsub_d, 0},
+    [FMUL_D_CODE] = {exec_fmul_d, 0},
+    [FDIV_D_CODE] = {exec_fdiv_d, 0},
+    [FSQRT_D_CODE] = {exec_fsqrt_d, 0},
+    [FSGNJ_D_CODE] = {exec_fsgnj_d, 0},
+    [FSGNJN_D_CODE] = {exec_fsgnjn_d, 0},
+    [FSGNJX_D_CODE] = {exec_fsgnjx_d, 0},
+    [FMIN_D_CODE] = {exec_fmin_d, 0},
+    [FMAX_D_CODE] = {exec_fmax_d, 0},
+    [FCVT_W_D_CODE] = {exec_fcvt_w_d, 0},
+    [FCVT_WU_D_CODE] = {exec_fcvt_wu_d, 0},
+    [FCVT_S_D_CODE] = {exec_fcvt_s_d, 0},
+    [FCVT_D_S_CODE] = {exec_fcvt_d_s, 0},
+    [FEQ_D_CODE] = {exec_feq_d, 0},
+    [FLT_D_CODE] = {exec_flt_d, 0},
+    [FLE_D_CODE] = {exec_fle_d, 0},
+    [FCLASS_D_CODE] = {exec_fclass_d, 0},
+    [FCVT_D_W_CODE] = {exec_fcvt_d_w, 0},
+    [FCVT_D_WU_CODE] = {exec_fcvt_d_wu, 0},
+};
+
+int fpu_decode(uint32_t instr, struct insn_t *insn)
+{
+    const struct fpu_desc_t *desc = &fpu_table[instr & 0x7F];
+    uint32_t imm = (instr >> 20) & 0xFFF;
+
+    if (desc->exec == NULL)
+        return 0;
+
+    insn->exec = desc->exec;
+    if (desc->imm)
+        extend_sign(&imm, 11);
+    else
+        imm = 0;
+    insn->imm = imm;
+
+    return 1;
+}
@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "types.h"
+#include "platform.h"
+#include "framebuffer.h"
+#include "iothread.h"
+
+static int framebuffer_read(void *opaque, uint32_t offset, enum access_type_t access_type, uint32_t *data)
+{
+    struct framebuffer_t *fb = opaque;
+
+    if (access_type != ACCESS_WORD)
+        return -1;
+
+    switch (offset)
+    {
+    case FB_ADDR:
+        *data = fb->addr;
+        break;
+    case FB_WIDTH:
+        *data = fb->width;
+        break;
+    case FB_HEIGHT:
+        *data = fb->height;
+        break;
+    case FB_DOORBELL:
+        *data = 0;
+        break;
+    case FB_FRAMES:
+        *data = (uint32_t)fb->frames;
+        break;
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+static int framebuffer_write(void *opaque, uint32_t offset, enum access_type_t access_type, uint32_t data)
+{
+    struct framebuffer_t *fb = opaque;
+    const uint32_t *pixels;
+
+    if (access_type != ACCESS_WORD)
+        return -1;
+
+    switch (offset)
+    {
+    case FB_ADDR:
+        fb->addr = data;
+        break;
+    case FB_WIDTH:
+        fb->width = data;
+        break;
+    case FB_HEIGHT:
+        fb->height = data;
+        break;
+    case FB_DOORBELL:
+        if ((pixels = framebuffer_pixels(fb)) == NULL)
+        {
+            iothread_printf(fb->platform->io, "[ERROR] Frame buffer %08x (%ux%u) is not in RAM\n", fb->addr, fb->width,
+                            fb->height);
+            return -1;
+        }
+        fb->frames++;
+        if (fb->listener)
+            fb->listener(fb->listener_opaque, fb, pixels);
+        break;
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+struct framebuffer_t *framebuffer_new(struct platform_t *platform)
+{
+    struct framebuffer_t *fb;
+
+    if ((fb = calloc(1, sizeof(struct framebuffer_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    fb->platform = platform;
+    platform_add_device(platform, "framebuffer", FB_BASE, FB_SIZE, framebuffer_read, framebuffer_write, fb);
+
+    return fb;
+}
+
+void framebuffer_free(struct framebuffer_t *fb)
+{
+    free(fb);
+}
+
+const uint32_t *framebuffer_pixels(const struct framebuffer_t *fb)
+{
+    uint64_t size = (uint64_t)fb->width * fb->height * 4;
+
+    if (size == 0 || size > UINT32_MAX || (fb->addr & 0x3))
+        return NULL;
+
+    return platform_host_range(fb->platform, fb->addr, size, 0);
+}
+
+void framebuffer_set_listener(struct framebuffer_t *fb, framebuffer_listener_t listener, void *opaque)
+{
+    fb->listener = listener;
+    fb->listener_opaque = opaque;
+}
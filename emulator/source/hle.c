@@ -0,0 +1,406 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "types.h"
+#include "platform.h"
+#include "minirisc.h"
+#include "callgraph.h"
+#include "iothread.h"
+#include "hle.h"
+
+/* ------------------------------------------------------------------------- */
+/* Host routines: arguments in regs[10..13], result in regs[10] (and 11)      */
+/* ------------------------------------------------------------------------- */
+
+static uint64_t arg64(const uint32_t *regs, int reg)
+{
+    return regs[reg] | (uint64_t)regs[reg + 1] << 32;
+}
+
+static void set_result64(uint32_t *regs, uint64_t value)
+{
+    regs[10] = value;
+    regs[11] = value >> 32;
+}
+
+/**
+ * Host address of the string at addr, with the number of bytes
+ * up to the end of RAM in *len.
+ */
+static const char *host_string(struct platform_t *platform, uint32_t addr, uint32_t *len)
+{
+    if (addr - RAM_BASE >= platform->size)
+        return NULL;
+    *len = platform->size - (addr - RAM_BASE);
+
+    return platform_host_range(platform, addr, *len, 0);
+}
+
+static int hle_memmove(struct platform_t *platform, uint32_t *regs)
+{
+    uint32_t len = regs[12];
+    const void *src;
+    void *dst;
+
+    if (len == 0)
+        return 0;
+    if ((src = platform_host_range(platform, regs[11], len, 0)) == NULL ||
+        (dst = platform_host_range(platform, regs[10], len, 1)) == NULL)
+        return -1;
+    memmove(dst, src, len);
+
+    return 0;
+}
+
+static int hle_memcpy(struct platform_t *platform, uint32_t *regs)
+{
+    /* What the guest does with overlapping ranges depends on its implementation */
+    if (regs[10] - regs[11] < regs[12] || regs[11] - regs[10] < regs[12])
+        return -1;
+
+    return hle_memmove(platform, regs);
+}
+
+static int hle_memset(struct platform_t *platform, uint32_t *regs)
+{
+    uint32_t len = regs[12];
+    void *dst;
+
+    if (len == 0)
+        return 0;
+    if ((dst = platform_host_range(platform, regs[10], len, 1)) == NULL)
+        return -1;
+    memset(dst, regs[11] & 0xFF, len);
+
+    return 0;
+}
+
+static int hle_strlen(struct platform_t *platform, uint32_t *regs)
+{
+    const char *s;
+    const char *end;
+    uint32_t len;
+
+    if ((s = host_string(platform, regs[10], &len)) == NULL || (end = memchr(s, '\0', len)) == NULL)
+        return -1;
+    regs[10] = end - s;
+
+    return 0;
+}
+
+static int hle_strcmp(struct platform_t *platform, uint32_t *regs)
+{
+    const unsigned char *a;
+    const unsigned char *b;
+    uint32_t len_a, len_b, i;
+
+    if ((a = (const unsigned char *)host_string(platform, regs[10], &len_a)) == NULL ||
+        (b = (const unsigned char *)host_string(platform, regs[11], &len_b)) == NULL)
+        return -1;
+
+    for (i = 0; i < len_a && i < len_b; i++)
+    {
+        if (a[i] != b[i] || a[i] == '\0')
+        {
+            regs[10] = (int32_t)a[i] - (int32_t)b[i];
+            return 0;
+        }
+    }
+
+    /* One of the strings runs to the end of RAM */
+    return -1;
+}
+
+/* Division by zero and INT64_MIN / -1 are left to libgcc */
+
+static int hle_divdi3(struct platform_t *platform, uint32_t *regs)
+{
+    int64_t a = arg64(regs, 10);
+    int64_t b = arg64(regs, 12);
+
+    (void)platform;
+    if (b == 0 || (a == INT64_MIN && b == -1))
+        return -1;
+    set_result64(regs, a / b);
+
+    return 0;
+}
+
+static int hle_moddi3(struct platform_t *platform, uint32_t *regs)
+{
+    int64_t a = arg64(regs, 10);
+    int64_t b = arg64(regs, 12);
+
+    (void)platform;
+    if (b == 0 || (a == INT64_MIN && b == -1))
+        return -1;
+    set_result64(regs, a % b);
+
+    return 0;
+}
+
+static int hle_udivdi3(struct platform_t *platform, uint32_t *regs)
+{
+    uint64_t b = arg64(regs, 12);
+
+    (void)platform;
+    if (b == 0)
+        return -1;
+    set_result64(regs, arg64(regs, 10) / b);
+
+    return 0;
+}
+
+static int hle_umoddi3(struct platform_t *platform, uint32_t *regs)
+{
+    uint64_t b = arg64(regs, 12);
+
+    (void)platform;
+    if (b == 0)
+        return -1;
+    set_result64(regs, arg64(regs, 10) % b);
+
+    return 0;
+}
+
+static int hle_muldi3(struct platform_t *platform, uint32_t *regs)
+{
+    (void)platform;
+    set_result64(regs, arg64(regs, 10) * arg64(regs, 12));
+
+    return 0;
+}
+
+static const struct hle_hook_t hle_table[] = {
+    {.name = "memcpy", .native = hle_memcpy, .results = 1, .writes = 1},
+    {.name = "memmove", .native = hle_memmove, .results = 1, .writes = 1},
+    {.name = "memset", .native = hle_memset, .results = 1, .writes = 1},
+    {.name = "strlen", .native = hle_strlen, .results = 1},
+    {.name = "strcmp", .native = hle_strcmp, .results = 1, .sign_only = 1},
+    {.name = "__divdi3", .native = hle_divdi3, .results = 2},
+    {.name = "__udivdi3", .native = hle_udivdi3, .results = 2},
+    {.name = "__moddi3", .native = hle_moddi3, .results = 2},
+    {.name = "__umoddi3", .native = hle_umoddi3, .results = 2},
+    {.name = "__muldi3", .native = hle_muldi3, .results = 2},
+};
+
+/* ------------------------------------------------------------------------- */
+/* Execution                                                                  */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Execute the guest instruction replaced by the hook, at PC.
+ */
+static void hle_exec_original(struct minirisc_t *minirisc, uint32_t raw)
+{
+    struct insn_t insn;
+
+    minirisc_decode(raw, &insn);
+    insn.exec(minirisc, &insn);
+}
+
+static int sign(uint32_t value)
+{
+    return ((int32_t)value > 0) - ((int32_t)value < 0);
+}
+
+/**
+ * Run the host routine on a copy of the registers, undo its writes, then
+ * run the guest function to its return and compare. The guest results
+ * are kept, so the run is the same as without hooks.
+ */
+static void hle_check(struct hle_t *hle, struct hle_hook_t *hook, uint32_t raw)
+{
+    struct minirisc_t *minirisc = hle->minirisc;
+    struct iothread_t *io = minirisc->platform->io;
+    uint32_t *regs = minirisc->regs;
+    uint32_t host[32];
+    uint32_t pc = minirisc->PC;
+    uint32_t ra = regs[1];
+    uint32_t sp = regs[2];
+    uint32_t dst = regs[10];
+    uint32_t len = hook->writes ? regs[12] : 0;
+    uint8_t *p = NULL;
+    int mismatch;
+    int native;
+    uint32_t i;
+
+    if (len > 0 && (p = platform_host_range(minirisc->platform, dst, len, 0)) != NULL)
+    {
+        if (2 * (size_t)len > hle->scratch_size)
+        {
+            free(hle->scratch);
+            hle->scratch_size = 2 * (size_t)len;
+            if ((hle->scratch = malloc(hle->scratch_size)) == NULL)
+            {
+                printf("Malloc error.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        memcpy(hle->scratch, p, len);
+    }
+
+    memcpy(host, regs, sizeof(host));
+    native = hook->native(minirisc->platform, host);
+    if (native == 0 && p != NULL)
+    {
+        memcpy(hle->scratch + len, p, len);
+        memcpy(p, hle->scratch, len);
+    }
+
+    /* The guest function, counted as usual: the engine adds the first instruction */
+    hle->checking = 1;
+    hle_exec_original(minirisc, raw);
+    minirisc->PC = minirisc->next_PC;
+    minirisc->instret++;
+    while (!minirisc->halt && (minirisc->PC != ra || regs[2] != sp) && minirisc->instret < minirisc->max_instret)
+        minirisc_step(minirisc);
+    minirisc->instret--;
+    hle->checking = 0;
+    minirisc->next_PC = minirisc->PC;
+
+    /* Stopped inside the function: the engine resumes it there */
+    if (native == -1 || minirisc->halt || minirisc->PC != ra || regs[2] != sp)
+    {
+        hle->declined += native == -1;
+        return;
+    }
+    hle->checked++;
+
+    if (hook->sign_only)
+        mismatch = sign(regs[10]) != sign(host[10]);
+    else
+        mismatch = regs[10] != host[10] || (hook->results == 2 && regs[11] != host[11]);
+    if (mismatch)
+        iothread_printf(io, "[HLE] %s at %08x called from %08x: guest a0 = %08x a1 = %08x, host a0 = %08x a1 = %08x\n",
+                        hook->name, pc, ra - 4, regs[10], regs[11], host[10], host[11]);
+
+    if (p != NULL && memcmp(p, hle->scratch + len, len) != 0)
+    {
+        for (i = 0; p[i] == hle->scratch[len + i]; i++)
+            ;
+        iothread_printf(io, "[HLE] %s at %08x called from %08x: guest byte %08x = %02x, host %02x\n", hook->name,
+                        pc, ra - 4, dst + i, p[i], hle->scratch[len + i]);
+        mismatch = 1;
+    }
+
+    if (mismatch)
+        minirisc->halt = 1;
+}
+
+/**
+ * Handler of a hooked function entry: run the host routine and return
+ * to ra, as one instruction.
+ */
+static void hle_exec(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    struct hle_t *hle = minirisc->hle;
+    struct hle_hook_t *hook = &hle->hooks[insn->imm];
+    uint32_t raw = insn->raw;
+
+    /* A loop back to the entry, or a call from a function being checked */
+    if (hle->checking)
+    {
+        hle_exec_original(minirisc, raw);
+        return;
+    }
+    if (hle->mode == HLE_CHECK)
+    {
+        hle_check(hle, hook, raw);
+        return;
+    }
+
+    if (hook->native(minirisc->platform, minirisc->regs) == -1)
+    {
+        hle->declined++;
+        hle_exec_original(minirisc, raw);
+        return;
+    }
+    hook->calls++;
+    minirisc->next_PC = minirisc->regs[1];
+    if (minirisc->callgraph)
+        callgraph_return(minirisc->callgraph, minirisc->next_PC, minirisc->instret + 1);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Setup                                                                      */
+/* ------------------------------------------------------------------------- */
+
+int hle_parse_mode(const char *name, enum hle_mode_t *mode)
+{
+    if (strcmp(name, "native") == 0)
+        *mode = HLE_NATIVE;
+    else if (strcmp(name, "check") == 0)
+        *mode = HLE_CHECK;
+    else
+        return -1;
+
+    return 0;
+}
+
+struct hle_t *hle_new(struct minirisc_t *minirisc, struct elf_t *elf, enum hle_mode_t mode)
+{
+    const struct elf_symbol_t *symbol;
+    struct hle_t *hle;
+    uint32_t i, j;
+
+    if ((hle = calloc(1, sizeof(struct hle_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    hle->minirisc = minirisc;
+    hle->mode = mode;
+
+    for (i = 0; i < sizeof(hle_table) / sizeof(hle_table[0]); i++)
+    {
+        if ((symbol = elf_symbol_by_name(elf, hle_table[i].name)) == NULL || (symbol->addr & 0x3) ||
+            symbol->addr - RAM_BASE >= minirisc->platform->size)
+            continue;
+        /* Aliases (memcpy = memmove in some libcs): the first hook wins */
+        for (j = 0; j < hle->n_hooks && hle->hooks[j].addr != symbol->addr; j++)
+            ;
+        if (j < hle->n_hooks)
+            continue;
+
+        hle->hooks[hle->n_hooks] = hle_table[i];
+        hle->hooks[hle->n_hooks].addr = symbol->addr;
+        hle->n_hooks++;
+    }
+
+    return hle;
+}
+
+void hle_free(struct hle_t *hle)
+{
+    free(hle->scratch);
+    free(hle);
+}
+
+void hle_decode(struct hle_t *hle, uint32_t pc, struct insn_t *insn)
+{
+    uint32_t i;
+
+    for (i = 0; i < hle->n_hooks; i++)
+    {
+        if (hle->hooks[i].addr == pc)
+        {
+            insn->exec = hle_exec;
+            insn->opcode = HLE_CODE;
+            insn->imm = i;
+            return;
+        }
+    }
+}
+
+uint64_t hle_calls(const struct hle_t *hle)
+{
+    uint64_t calls = 0;
+    uint32_t i;
+
+    for (i = 0; i < hle->n_hooks; i++)
+        calls += hle->hooks[i].calls;
+
+    return calls;
+}
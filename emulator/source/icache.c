@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "types.h"
+#include "minirisc.h"
+#include "platform.h"
+#include "icache.h"
+
+/**
+ * Initial handler of every cache entry: fetch the instruction at PC,
+ * decode it in place and execute it.
+ */
+static void exec_decode(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t instr;
+
+    platform_read(minirisc->platform, ACCESS_WORD, minirisc->PC, &instr);
+    minirisc_decode_at(minirisc, minirisc->PC, instr, insn);
+    insn->exec(minirisc, insn);
+}
+
+static void icache_reset_entry(struct icache_t *icache, struct insn_t *insn)
+{
+    insn->exec = exec_decode;
+    insn->label = icache->undecoded_label;
+    insn->opcode = 0;
+}
+
+struct icache_t *icache_new(struct minirisc_t *minirisc)
+{
+    struct icache_t *icache;
+
+    if ((icache = malloc(sizeof(struct icache_t))) == NULL)
+    {
+        printf("Error icache malloc.\n");
+        return NULL;
+    }
+
+    icache->minirisc = minirisc;
+    icache->undecoded_label = NULL;
+    icache->n_pages = minirisc->platform->size >> PAGE_SHIFT;
+    if ((icache->pages = calloc(icache->n_pages, sizeof(struct insn_t *))) == NULL)
+    {
+        printf("Error icache malloc.\n");
+        free(icache);
+        return NULL;
+    }
+
+    return icache;
+}
+
+void icache_free(struct icache_t *icache)
+{
+    uint32_t i;
+
+    for (i = 0; i < icache->n_pages; i++)
+        free(icache->pages[i]);
+    free(icache->pages);
+    free(icache);
+}
+
+struct insn_t *icache_fill(struct icache_t *icache, uint32_t pc)
+{
+    struct platform_t *platform = icache->minirisc->platform;
+    uint32_t offset = pc - RAM_BASE;
+    struct insn_t *page;
+    uint32_t instr;
+    int i;
+
+    /* Outside RAM or misaligned: decode without caching */
+    if (((offset >> PAGE_SHIFT) >= icache->n_pages) || (pc & 0x3))
+    {
+        if (platform_read(platform, ACCESS_WORD, pc, &instr) == -1)
+            minirisc_decode_fetch_fault(&icache->scratch);
+        else
+            minirisc_decode(instr, &icache->scratch);
+        icache->scratch.label = icache->undecoded_label;
+        return &icache->scratch;
+    }
+
+    if ((page = malloc(ICACHE_INSNS_PER_PAGE * sizeof(struct insn_t))) == NULL)
+    {
+        printf("Error icache malloc.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < ICACHE_INSNS_PER_PAGE; i++)
+        icache_reset_entry(icache, &page[i]);
+
+    icache->pages[offset >> PAGE_SHIFT] = page;
+    platform_mark_code(platform, pc);
+
+    return &page[(offset & PAGE_MASK) >> 2];
+}
+
+void icache_flush(struct icache_t *icache)
+{
+    uint32_t i;
+    int j;
+
+    for (i = 0; i < icache->n_pages; i++)
+    {
+        if (icache->pages[i] == NULL)
+            continue;
+        for (j = 0; j < ICACHE_INSNS_PER_PAGE; j++)
+            icache_reset_entry(icache, &icache->pages[i][j]);
+    }
+}
+
+void icache_decode(struct icache_t *icache, struct insn_t *insn, uint32_t pc)
+{
+    uint32_t instr;
+
+    if (platform_read(icache->minirisc->platform, ACCESS_WORD, pc, &instr) == -1)
+        minirisc_decode_fetch_fault(insn);
+    else
+        minirisc_decode_at(icache->minirisc, pc, instr, insn);
+}
+
+void icache_invalidate(struct icache_t *icache, uint32_t addr, uint32_t len)
+{
+    uint32_t offset = (addr - RAM_BASE) & ~0x3;
+    uint32_t end = addr - RAM_BASE + len;
+    struct insn_t *page;
+
+    for (; offset < end; offset += 4)
+    {
+        if ((offset >> PAGE_SHIFT) >= icache->n_pages)
+            break;
+        if ((page = icache->pages[offset >> PAGE_SHIFT]) != NULL)
+            icache_reset_entry(icache, &page[(offset & PAGE_MASK) >> 2]);
+    }
+}
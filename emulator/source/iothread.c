@@ -0,0 +1,244 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "iothread.h"
+
+#define IOTHREAD_IDLE_NS 100000 /* Thread sleep when there is nothing to write */
+
+int iothread_parse_policy(const char *name, enum iothread_policy_t *policy)
+{
+    if (strcmp(name, "block") == 0)
+        *policy = IOTHREAD_BLOCK;
+    else if (strcmp(name, "drop") == 0)
+        *policy = IOTHREAD_DROP;
+    else
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Write the console bytes up to the end of the ring or of the posted data.
+ * @return 0 if the ring was empty
+ */
+static int iothread_drain_console(struct iothread_t *io)
+{
+    const struct timespec idle = {0, IOTHREAD_IDLE_NS};
+    uint32_t head = atomic_load_explicit(&io->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&io->tail, memory_order_acquire);
+    uint32_t offset = head & (IOTHREAD_CONSOLE_SIZE - 1);
+    uint32_t len = tail - head;
+    ssize_t n;
+
+    if (len == 0)
+        return 0;
+    if (len > IOTHREAD_CONSOLE_SIZE - offset)
+        len = IOTHREAD_CONSOLE_SIZE - offset;
+
+    if ((n = write(STDOUT_FILENO, io->console + offset, len)) == -1)
+    {
+        if (errno == EAGAIN)
+            nanosleep(&idle, NULL);
+        if (errno == EINTR || errno == EAGAIN)
+            return 1;
+        /* stdout is gone: the output is lost, as it would be with printf() */
+        n = len;
+    }
+    atomic_store_explicit(&io->head, head + n, memory_order_release);
+
+    return 1;
+}
+
+static void *iothread_main(void *arg)
+{
+    struct iothread_t *io = arg;
+    const struct timespec idle = {0, IOTHREAD_IDLE_NS};
+    uint64_t generation;
+    uint32_t i;
+    int stop;
+    int work;
+
+    for (;;)
+    {
+        /* Anything posted before these loads is seen by this pass */
+        stop = atomic_load_explicit(&io->stop, memory_order_acquire);
+        generation = atomic_load_explicit(&io->sync_requested, memory_order_acquire);
+
+        work = iothread_drain_console(io);
+        for (i = 0; i < io->n_sinks; i++)
+            work |= io->sinks[i].drain(io->sinks[i].opaque);
+        if (work)
+            continue;
+
+        atomic_store_explicit(&io->sync_done, generation, memory_order_release);
+        if (stop)
+            break;
+        nanosleep(&idle, NULL);
+    }
+
+    return NULL;
+}
+
+void iothread_start(struct iothread_t *io)
+{
+    if (io->running)
+        return;
+
+    atomic_store_explicit(&io->stop, 0, memory_order_relaxed);
+    if (pthread_create(&io->thread, NULL, iothread_main, io) != 0)
+    {
+        printf("Error while starting the I/O thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    io->running = 1;
+}
+
+void iothread_stop(struct iothread_t *io)
+{
+    if (!io->running)
+        return;
+
+    atomic_store_explicit(&io->stop, 1, memory_order_release);
+    pthread_join(io->thread, NULL);
+    io->running = 0;
+}
+
+struct iothread_t *iothread_new(void)
+{
+    struct iothread_t *io;
+
+    if ((io = calloc(1, sizeof(struct iothread_t))) == NULL ||
+        (io->console = malloc(IOTHREAD_CONSOLE_SIZE)) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    io->policy = IOTHREAD_BLOCK;
+    iothread_start(io);
+
+    return io;
+}
+
+void iothread_free(struct iothread_t *io)
+{
+    iothread_stop(io);
+    free(io->console);
+    free(io);
+}
+
+void iothread_sync(struct iothread_t *io)
+{
+    uint64_t generation;
+
+    if (!io->running)
+        return;
+
+    generation = atomic_fetch_add_explicit(&io->sync_requested, 1, memory_order_acq_rel) + 1;
+    while (atomic_load_explicit(&io->sync_done, memory_order_acquire) < generation)
+        sched_yield();
+}
+
+/* The sink table is only changed while the thread is stopped */
+
+void iothread_add_sink(struct iothread_t *io, iothread_drain_t drain, void *opaque)
+{
+    int running = io->running;
+
+    if (io->n_sinks == IOTHREAD_MAX_SINKS)
+    {
+        printf("Too many I/O thread sinks.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    iothread_stop(io);
+    io->sinks[io->n_sinks].drain = drain;
+    io->sinks[io->n_sinks].opaque = opaque;
+    io->n_sinks++;
+    if (running)
+        iothread_start(io);
+}
+
+void iothread_remove_sink(struct iothread_t *io, void *opaque)
+{
+    int running = io->running;
+    uint32_t i;
+
+    iothread_stop(io);
+    for (i = 0; i < io->n_sinks; i++)
+    {
+        if (io->sinks[i].opaque != opaque)
+            continue;
+        /* Left over by a stopped thread */
+        while (io->sinks[i].drain(opaque))
+            ;
+        io->n_sinks--;
+        memmove(&io->sinks[i], &io->sinks[i + 1], (io->n_sinks - i) * sizeof(io->sinks[0]));
+        break;
+    }
+    if (running)
+        iothread_start(io);
+}
+
+void iothread_write(struct iothread_t *io, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    uint32_t tail = atomic_load_explicit(&io->tail, memory_order_relaxed);
+    uint32_t room, offset, n;
+
+    if (io->policy == IOTHREAD_DROP &&
+        len > IOTHREAD_CONSOLE_SIZE - (tail - atomic_load_explicit(&io->head, memory_order_acquire)))
+    {
+        io->dropped += len;
+        return;
+    }
+
+    while (len > 0)
+    {
+        /* Backpressure: wait for the thread to make room */
+        while ((room = IOTHREAD_CONSOLE_SIZE - (tail - atomic_load_explicit(&io->head, memory_order_acquire))) == 0)
+        {
+            if (!io->running)
+                iothread_drain_console(io);
+            else
+                sched_yield();
+        }
+
+        offset = tail & (IOTHREAD_CONSOLE_SIZE - 1);
+        n = IOTHREAD_CONSOLE_SIZE - offset;
+        if (n > room)
+            n = room;
+        if (n > len)
+            n = len;
+        memcpy(io->console + offset, p, n);
+        p += n;
+        len -= n;
+        tail += n;
+        atomic_store_explicit(&io->tail, tail, memory_order_release);
+    }
+
+    /* Nobody else will write it */
+    if (!io->running)
+        while (iothread_drain_console(io))
+            ;
+}
+
+void iothread_printf(struct iothread_t *io, const char *format, ...)
+{
+    char record[IOTHREAD_LOG_SIZE];
+    va_list ap;
+    int len;
+
+    va_start(ap, format);
+    len = vsnprintf(record, sizeof(record), format, ap);
+    va_end(ap);
+
+    if (len < 0)
+        return;
+    iothread_write(io, record, (size_t)len < sizeof(record) ? (size_t)len : sizeof(record) - 1);
+}
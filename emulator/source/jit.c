@@ -0,0 +1,664 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "types.h"
+#include "minirisc.h"
+#include "platform.h"
+#include "block.h"
+#include "jit.h"
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+/* Host registers */
+#define EAX 0
+#define ECX 1
+#define EDX 2
+
+/* Offsets used by the generated code */
+#define OFF_REG(r) ((int32_t)(offsetof(struct minirisc_t, regs) + 4 * (r)))
+#define OFF_PC ((int32_t)offsetof(struct minirisc_t, PC))
+#define OFF_NEXT_PC ((int32_t)offsetof(struct minirisc_t, next_PC))
+#define OFF_HALT ((int32_t)offsetof(struct minirisc_t, halt))
+#define OFF_PLATFORM ((int32_t)offsetof(struct minirisc_t, platform))
+#define OFF_INSTRET ((int32_t)offsetof(struct minirisc_t, instret))
+#define OFF_STATS(field) ((int32_t)(offsetof(struct minirisc_t, stats) + offsetof(struct stats_t, field)))
+
+/* x86 condition codes, used by jcc/setcc/cmovcc */
+#define CC_B 0x2
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_L 0xC
+#define CC_GE 0xD
+
+/* Group 1 ALU operations: opcode for "op r32, r/m32" and /digit for "op r/m32, imm32" */
+#define ALU_ADD 0
+#define ALU_OR 1
+#define ALU_AND 4
+#define ALU_SUB 5
+#define ALU_XOR 6
+#define ALU_CMP 7
+
+struct emitter_t
+{
+    uint8_t *p;
+    uint32_t end_pc; /* Address following the block */
+};
+
+static void emit8(struct emitter_t *e, uint8_t b)
+{
+    *e->p++ = b;
+}
+
+static void emit32(struct emitter_t *e, uint32_t v)
+{
+    memcpy(e->p, &v, 4);
+    e->p += 4;
+}
+
+static void emit64(struct emitter_t *e, uint64_t v)
+{
+    memcpy(e->p, &v, 8);
+    e->p += 8;
+}
+
+/* mov r32, [rbx + disp32] */
+static void emit_load_rbx(struct emitter_t *e, int reg, int32_t disp)
+{
+    emit8(e, 0x8B);
+    emit8(e, 0x83 | (reg << 3));
+    emit32(e, disp);
+}
+
+/* mov [rbx + disp32], r32 */
+static void emit_store_rbx(struct emitter_t *e, int reg, int32_t disp)
+{
+    emit8(e, 0x89);
+    emit8(e, 0x83 | (reg << 3));
+    emit32(e, disp);
+}
+
+/* mov dword [rbx + disp32], imm32 */
+static void emit_store_rbx_imm(struct emitter_t *e, int32_t disp, uint32_t imm)
+{
+    emit8(e, 0xC7);
+    emit8(e, 0x83);
+    emit32(e, disp);
+    emit32(e, imm);
+}
+
+/* mov r32, imm32 */
+static void emit_mov_imm(struct emitter_t *e, int reg, uint32_t imm)
+{
+    emit8(e, 0xB8 + reg);
+    emit32(e, imm);
+}
+
+/* op r32, [rbx + disp32] */
+static void emit_alu_rbx(struct emitter_t *e, int alu, int reg, int32_t disp)
+{
+    emit8(e, (alu << 3) | 0x03);
+    emit8(e, 0x83 | (reg << 3));
+    emit32(e, disp);
+}
+
+/* op r32, imm32 */
+static void emit_alu_imm(struct emitter_t *e, int alu, int reg, uint32_t imm)
+{
+    emit8(e, 0x81);
+    emit8(e, 0xC0 | (alu << 3) | reg);
+    emit32(e, imm);
+}
+
+/* shl/shr/sar r32, imm8 (digit 4/5/7) */
+static void emit_shift_imm(struct emitter_t *e, int digit, int reg, uint8_t imm)
+{
+    emit8(e, 0xC1);
+    emit8(e, 0xC0 | (digit << 3) | reg);
+    emit8(e, imm);
+}
+
+/* shl/shr/sar r32, cl (digit 4/5/7) */
+static void emit_shift_cl(struct emitter_t *e, int digit, int reg)
+{
+    emit8(e, 0xD3);
+    emit8(e, 0xC0 | (digit << 3) | reg);
+}
+
+/* setcc al ; movzx eax, al */
+static void emit_setcc_eax(struct emitter_t *e, int cc)
+{
+    emit8(e, 0x0F);
+    emit8(e, 0x90 | cc);
+    emit8(e, 0xC0);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit8(e, 0xC0);
+}
+
+/* jcc rel32, returns the address of the displacement to patch */
+static uint8_t *emit_jcc(struct emitter_t *e, int cc)
+{
+    emit8(e, 0x0F);
+    emit8(e, 0x80 | cc);
+    emit32(e, 0);
+    return e->p - 4;
+}
+
+/* jmp rel32, returns the address of the displacement to patch */
+static uint8_t *emit_jmp(struct emitter_t *e)
+{
+    emit8(e, 0xE9);
+    emit32(e, 0);
+    return e->p - 4;
+}
+
+static void patch_here(struct emitter_t *e, uint8_t *disp)
+{
+    int32_t rel = (int32_t)(e->p - (disp + 4));
+    memcpy(disp, &rel, 4);
+}
+
+/* Guest register rd <- host eax, writes to x0 are dropped */
+static void emit_set_reg(struct emitter_t *e, int rd)
+{
+    if (rd != 0)
+        emit_store_rbx(e, EAX, OFF_REG(rd));
+}
+
+static void emit_prologue(struct emitter_t *e)
+{
+    emit8(e, 0x53);                     /* push rbx */
+    emit8(e, 0x41), emit8(e, 0x54);     /* push r12 */
+    emit8(e, 0x41), emit8(e, 0x55);     /* push r13 */
+    emit8(e, 0x41), emit8(e, 0x56);     /* push r14 */
+    emit8(e, 0x41), emit8(e, 0x57);     /* push r15 (keeps rsp 16-byte aligned) */
+    emit8(e, 0x48), emit8(e, 0x89), emit8(e, 0xFB); /* mov rbx, rdi */
+
+    /* rax = platform ; r12 = read TLB ; r14 = write TLB */
+    emit8(e, 0x48), emit8(e, 0x8B), emit8(e, 0x83), emit32(e, OFF_PLATFORM);
+    emit8(e, 0x4C), emit8(e, 0x8D), emit8(e, 0xA0), emit32(e, offsetof(struct platform_t, tlb_read));
+    emit8(e, 0x4C), emit8(e, 0x8D), emit8(e, 0xB0), emit32(e, offsetof(struct platform_t, tlb_write));
+}
+
+static void emit_epilogue(struct emitter_t *e)
+{
+    emit8(e, 0x41), emit8(e, 0x5F); /* pop r15 */
+    emit8(e, 0x41), emit8(e, 0x5E); /* pop r14 */
+    emit8(e, 0x41), emit8(e, 0x5D); /* pop r13 */
+    emit8(e, 0x41), emit8(e, 0x5C); /* pop r12 */
+    emit8(e, 0x5B);                 /* pop rbx */
+    emit8(e, 0xC3);                 /* ret */
+}
+
+#ifdef MINIRISC_STATS
+/* inc qword [rbx + disp] */
+static void emit_stats_inc(struct emitter_t *e, int32_t disp)
+{
+    emit8(e, 0x48), emit8(e, 0xFF), emit8(e, 0x83), emit32(e, disp);
+}
+
+/* add qword [rbx + disp], rax */
+static void emit_stats_add_rax(struct emitter_t *e, int32_t disp)
+{
+    emit8(e, 0x48), emit8(e, 0x01), emit8(e, 0x83), emit32(e, disp);
+}
+#endif
+
+/* PC <- next_PC and leave the block */
+static void emit_exit_next_pc(struct emitter_t *e)
+{
+    emit_load_rbx(e, EAX, OFF_NEXT_PC);
+    emit_store_rbx(e, EAX, OFF_PC);
+    emit_epilogue(e);
+}
+
+/**
+ * Call the interpreter handler of insn with PC, next_PC and instret set
+ * up as the interpreter would: devices (the virtual timer) see the
+ * instructions retired before this one, not the whole block.
+ */
+static void emit_call_handler(struct emitter_t *e, struct insn_t *insn, uint32_t pc)
+{
+    uint32_t ahead = (e->end_pc - pc) / 4;
+
+    emit_store_rbx_imm(e, OFF_PC, pc);
+    emit_store_rbx_imm(e, OFF_NEXT_PC, pc + 4);
+    emit8(e, 0x48), emit8(e, 0x81), emit8(e, 0xAB), emit32(e, OFF_INSTRET), emit32(e, ahead); /* sub qword [instret], ahead */
+    emit8(e, 0x48), emit8(e, 0x89), emit8(e, 0xDF); /* mov rdi, rbx */
+    emit8(e, 0x48), emit8(e, 0xBE), emit64(e, (uint64_t)(uintptr_t)insn); /* mov rsi, insn */
+    emit8(e, 0x48), emit8(e, 0xB8), emit64(e, (uint64_t)(uintptr_t)insn->exec); /* mov rax, exec */
+    emit8(e, 0xFF), emit8(e, 0xD0); /* call rax */
+    emit8(e, 0x48), emit8(e, 0x81), emit8(e, 0x83), emit32(e, OFF_INSTRET), emit32(e, ahead); /* add qword [instret], ahead */
+}
+
+/**
+ * After a handler call for the instruction at pc in the middle of a block:
+ * leave if the CPU halted or the store hit translated code. instret was
+ * credited with the whole block on entry, the skipped instructions are
+ * taken back.
+ */
+static void emit_check_exit(struct emitter_t *e, struct jit_t *jit, uint32_t pc)
+{
+    uint32_t skipped = (e->end_pc - pc - 4) / 4;
+    uint8_t *skip;
+
+    emit8(e, 0x48), emit8(e, 0xB8), emit64(e, (uint64_t)(uintptr_t)&jit->cache->dirty); /* mov rax, &dirty */
+    emit8(e, 0x8B), emit8(e, 0x00);        /* mov eax, [rax] */
+    emit_alu_rbx(e, ALU_OR, EAX, OFF_HALT); /* or eax, [halt] */
+    skip = emit_jcc(e, CC_E);
+    if (skipped)
+    {
+        emit8(e, 0x48), emit8(e, 0x81), emit8(e, 0xAB), emit32(e, OFF_INSTRET), emit32(e, skipped); /* sub qword [instret], skipped */
+    }
+    emit_exit_next_pc(e);
+    patch_here(e, skip);
+}
+
+/* The lookup below indexes the TLB with a shifted address and reads the addend at +8 */
+_Static_assert(sizeof(struct tlb_entry_t) == 16, "TLB entries must be 16 bytes");
+_Static_assert(offsetof(struct tlb_entry_t, addend) == 8, "TLB addend must be at offset 8");
+
+/**
+ * Inline software TLB lookup, as platform_read() / platform_write() do:
+ * rax <- host address of the guest address rs1 + imm, or jump to the
+ * slow path on a miss or a misaligned address. tlb is the ModRM base
+ * register of the TLB (4 = r12 for reads, 6 = r14 for writes).
+ * Returns the jump to patch.
+ */
+static uint8_t *emit_tlb_lookup(struct emitter_t *e, struct insn_t *insn, uint8_t align_mask, int tlb)
+{
+    uint8_t *slow;
+
+    emit_load_rbx(e, EAX, OFF_REG(insn->rs1));
+    emit8(e, 0x05), emit32(e, insn->imm);               /* add eax, imm */
+    emit8(e, 0x89), emit8(e, 0xC1);                     /* mov ecx, eax */
+    emit_shift_imm(e, 5, ECX, PAGE_SHIFT - 4);          /* shr ecx, PAGE_SHIFT - 4 */
+    emit_alu_imm(e, ALU_AND, ECX, (TLB_SIZE - 1) << 4); /* ecx <- entry offset */
+    emit8(e, 0x89), emit8(e, 0xC2);                     /* mov edx, eax */
+    emit_alu_imm(e, ALU_AND, EDX, ~PAGE_MASK | align_mask);
+    emit8(e, 0x41), emit8(e, 0x3B), emit8(e, 0x14), emit8(e, 0x08 | tlb); /* cmp edx, [tlb + rcx] */
+    slow = emit_jcc(e, CC_NE);
+    emit8(e, 0x49), emit8(e, 0x03), emit8(e, 0x44), emit8(e, 0x08 | tlb), emit8(e, 0x08); /* add rax, [tlb + rcx + 8] */
+
+    return slow;
+}
+
+static void emit_load(struct emitter_t *e, struct jit_t *jit, struct insn_t *insn, uint32_t pc)
+{
+    uint8_t *slow;
+    uint8_t *done;
+    uint8_t align = (insn->opcode == LW_CODE) ? 0x3 : (insn->opcode == LH_CODE || insn->opcode == LHU_CODE) ? 0x1 : 0;
+
+    slow = emit_tlb_lookup(e, insn, align, 4);
+#ifdef MINIRISC_STATS
+    /* The slow path counts in the interpreter handler */
+    emit_stats_inc(e, OFF_STATS(loads));
+#endif
+
+    /* eax <- [rax] with the width and extension of the load */
+    switch (insn->opcode)
+    {
+    case LB_CODE:
+        emit8(e, 0x0F), emit8(e, 0xBE);
+        break;
+    case LBU_CODE:
+        emit8(e, 0x0F), emit8(e, 0xB6);
+        break;
+    case LH_CODE:
+        emit8(e, 0x0F), emit8(e, 0xBF);
+        break;
+    case LHU_CODE:
+        emit8(e, 0x0F), emit8(e, 0xB7);
+        break;
+    default:
+        emit8(e, 0x8B);
+        break;
+    }
+    emit8(e, 0x00);
+    emit_set_reg(e, insn->rd);
+    done = emit_jmp(e);
+
+    /* Slow path: TLB miss, device or fault */
+    patch_here(e, slow);
+    emit_call_handler(e, insn, pc);
+    emit_check_exit(e, jit, pc);
+
+    patch_here(e, done);
+}
+
+static void emit_store(struct emitter_t *e, struct jit_t *jit, struct insn_t *insn, uint32_t pc)
+{
+    uint8_t *slow;
+    uint8_t *done;
+    uint8_t align = (insn->opcode == SW_CODE) ? 0x3 : (insn->opcode == SH_CODE) ? 0x1 : 0;
+
+    /* Pages holding translated code never enter the write TLB */
+    slow = emit_tlb_lookup(e, insn, align, 6);
+#ifdef MINIRISC_STATS
+    emit_stats_inc(e, OFF_STATS(stores));
+#endif
+
+    emit_load_rbx(e, EDX, OFF_REG(insn->rd));
+    switch (insn->opcode)
+    {
+    case SB_CODE:
+        emit8(e, 0x88); /* mov [rax], dl */
+        break;
+    case SH_CODE:
+        emit8(e, 0x66), emit8(e, 0x89); /* mov [rax], dx */
+        break;
+    default:
+        emit8(e, 0x89); /* mov [rax], edx */
+        break;
+    }
+    emit8(e, 0x10);
+    done = emit_jmp(e);
+
+    /* Slow path: TLB miss, device, fault or self-modifying code */
+    patch_here(e, slow);
+    emit_call_handler(e, insn, pc);
+    emit_check_exit(e, jit, pc);
+
+    patch_here(e, done);
+}
+
+/* rd <- rs1 op rs2 */
+static void emit_alu_rr(struct emitter_t *e, struct insn_t *insn, int alu)
+{
+    if (insn->rd == 0)
+        return;
+    emit_load_rbx(e, EAX, OFF_REG(insn->rs1));
+    emit_alu_rbx(e, alu, EAX, OFF_REG(insn->rs2));
+    emit_set_reg(e, insn->rd);
+}
+
+/* rd <- rs1 op imm */
+static void emit_alu_ri(struct emitter_t *e, struct insn_t *insn, int alu)
+{
+    if (insn->rd == 0)
+        return;
+    emit_load_rbx(e, EAX, OFF_REG(insn->rs1));
+    emit_alu_imm(e, alu, EAX, insn->imm);
+    emit_set_reg(e, insn->rd);
+}
+
+/* rd <- rs1 shift (rs2 & 0x1F) */
+static void emit_shift_rr(struct emitter_t *e, struct insn_t *insn, int digit)
+{
+    if (insn->rd == 0)
+        return;
+    emit_load_rbx(e, EAX, OFF_REG(insn->rs1));
+    emit_load_rbx(e, ECX, OFF_REG(insn->rs2));
+    emit_shift_cl(e, digit, EAX);
+    emit_set_reg(e, insn->rd);
+}
+
+/* rd <- (rs1 cmp second) where second is rs2 or imm */
+static void emit_set_less(struct emitter_t *e, struct insn_t *insn, int cc, int with_imm)
+{
+    if (insn->rd == 0)
+        return;
+    emit_load_rbx(e, ECX, OFF_REG(insn->rs1));
+    if (with_imm)
+        emit_alu_imm(e, ALU_CMP, ECX, insn->imm);
+    else
+        emit_alu_rbx(e, ALU_CMP, ECX, OFF_REG(insn->rs2));
+    emit_setcc_eax(e, cc);
+    emit_set_reg(e, insn->rd);
+}
+
+/* PC <- (rs1 cmp rd) ? target : fall-through, then leave */
+static void emit_branch(struct emitter_t *e, struct insn_t *insn, uint32_t pc, int cc)
+{
+    emit_load_rbx(e, EAX, OFF_REG(insn->rs1));
+    emit_alu_rbx(e, ALU_CMP, EAX, OFF_REG(insn->rd));
+    emit_mov_imm(e, ECX, pc + 4);
+    emit_mov_imm(e, EDX, pc + insn->imm);
+    emit8(e, 0x0F), emit8(e, 0x40 | cc), emit8(e, 0xCA); /* cmovcc ecx, edx */
+    emit_store_rbx(e, ECX, OFF_PC);
+#ifdef MINIRISC_STATS
+    /* Flags still hold the comparison */
+    emit_setcc_eax(e, cc);
+    emit_stats_add_rax(e, OFF_STATS(branches_taken));
+    emit8(e, 0x83), emit8(e, 0xF0), emit8(e, 0x01); /* xor eax, 1 */
+    emit_stats_add_rax(e, OFF_STATS(branches_not_taken));
+#endif
+    emit_epilogue(e);
+}
+
+/**
+ * Emit one instruction. Returns 1 if it ended the block (PC already set).
+ */
+static int emit_insn(struct emitter_t *e, struct jit_t *jit, struct insn_t *insn, uint32_t pc)
+{
+    switch (insn->opcode)
+    {
+    case LUI_CODE:
+        if (insn->rd != 0)
+            emit_store_rbx_imm(e, OFF_REG(insn->rd), insn->imm);
+        return 0;
+    case AUIPC_CODE:
+        if (insn->rd != 0)
+            emit_store_rbx_imm(e, OFF_REG(insn->rd), pc + insn->imm);
+        return 0;
+    case JAL_CODE:
+        if (insn->rd != 0)
+            emit_store_rbx_imm(e, OFF_REG(insn->rd), pc + 4);
+        emit_store_rbx_imm(e, OFF_PC, pc + insn->imm);
+        emit_epilogue(e);
+        return 1;
+    case JALR_CODE:
+        emit_load_rbx(e, EAX, OFF_REG(insn->rs1));
+        emit_alu_imm(e, ALU_ADD, EAX, insn->imm);
+        emit_alu_imm(e, ALU_AND, EAX, ~0x1u);
+        emit_store_rbx(e, EAX, OFF_PC);
+        if (insn->rd != 0)
+            emit_store_rbx_imm(e, OFF_REG(insn->rd), pc + 4);
+        emit_epilogue(e);
+        return 1;
+    case BEQ_CODE:
+        emit_branch(e, insn, pc, CC_E);
+        return 1;
+    case BNE_CODE:
+        emit_branch(e, insn, pc, CC_NE);
+        return 1;
+    case BLT_CODE:
+        emit_branch(e, insn, pc, CC_L);
+        return 1;
+    case BGE_CODE:
+        emit_branch(e, insn, pc, CC_GE);
+        return 1;
+    case BLTU_CODE:
+        emit_branch(e, insn, pc, CC_B);
+        return 1;
+    case BGEU_CODE:
+        emit_branch(e, insn, pc, CC_AE);
+        return 1;
+    case LB_CODE:
+    case LH_CODE:
+    case LW_CODE:
+    case LBU_CODE:
+    case LHU_CODE:
+        emit_load(e, jit, insn, pc);
+        return 0;
+    case SB_CODE:
+    case SH_CODE:
+    case SW_CODE:
+        emit_store(e, jit, insn, pc);
+        return 0;
+    case ADDI_CODE:
+        emit_alu_ri(e, insn, ALU_ADD);
+        return 0;
+    case XORI_CODE:
+        emit_alu_ri(e, insn, ALU_XOR);
+        return 0;
+    case ORI_CODE:
+        emit_alu_ri(e, insn, ALU_OR);
+        return 0;
+    case ANDI_CODE:
+        emit_alu_ri(e, insn, ALU_AND);
+        return 0;
+    case SLTI_CODE:
+        emit_set_less(e, insn, CC_L, 1);
+        return 0;
+    case SLTIU_CODE:
+        emit_set_less(e, insn, CC_B, 1);
+        return 0;
+    case SLLI_CODE:
+    case SRLI_CODE:
+    case SRAI_CODE:
+        if (insn->rd == 0)
+            return 0;
+        emit_load_rbx(e, EAX, OFF_REG(insn->rs1));
+        emit_shift_imm(e, insn->opcode == SLLI_CODE ? 4 : insn->opcode == SRLI_CODE ? 5 : 7, EAX, insn->imm);
+        emit_set_reg(e, insn->rd);
+        return 0;
+    case ADD_CODE:
+        emit_alu_rr(e, insn, ALU_ADD);
+        return 0;
+    case SUB_CODE:
+        emit_alu_rr(e, insn, ALU_SUB);
+        return 0;
+    case XOR_CODE:
+        emit_alu_rr(e, insn, ALU_XOR);
+        return 0;
+    case OR_CODE:
+        emit_alu_rr(e, insn, ALU_OR);
+        return 0;
+    case AND_CODE:
+        emit_alu_rr(e, insn, ALU_AND);
+        return 0;
+    case SLL_CODE:
+        emit_shift_rr(e, insn, 4);
+        return 0;
+    case SRL_CODE:
+        emit_shift_rr(e, insn, 5);
+        return 0;
+    case SRA_CODE:
+        emit_shift_rr(e, insn, 7);
+        return 0;
+    case SLT_CODE:
+        emit_set_less(e, insn, CC_L, 0);
+        return 0;
+    case SLTU_CODE:
+        emit_set_less(e, insn, CC_B, 0);
+        return 0;
+    case MUL_CODE:
+        if (insn->rd == 0)
+            return 0;
+        emit_load_rbx(e, EAX, OFF_REG(insn->rs1));
+        emit8(e, 0x0F), emit8(e, 0xAF), emit8(e, 0x83), emit32(e, OFF_REG(insn->rs2)); /* imul eax, [rs2] */
+        emit_set_reg(e, insn->rd);
+        return 0;
+    default:
+        /* MULH*, DIV*, REM*, F / D, ECALL, EBREAK, unknown: interpreter handler */
+        emit_call_handler(e, insn, pc);
+        if (minirisc_insn_ends_block(insn))
+        {
+            emit_exit_next_pc(e);
+            return 1;
+        }
+        emit_check_exit(e, jit, pc);
+        return 0;
+    }
+}
+
+struct jit_t *jit_new(struct block_cache_t *cache)
+{
+    struct jit_t *jit;
+
+    if ((jit = malloc(sizeof(struct jit_t))) == NULL)
+    {
+        printf("Error jit malloc.\n");
+        return NULL;
+    }
+
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED)
+    {
+        perror("Error jit mmap");
+        free(jit);
+        return NULL;
+    }
+    jit->code_used = 0;
+    jit->cache = cache;
+
+    return jit;
+}
+
+void jit_free(struct jit_t *jit)
+{
+    munmap(jit->code, JIT_CODE_SIZE);
+    free(jit);
+}
+
+void jit_flush(struct jit_t *jit)
+{
+    jit->code_used = 0;
+}
+
+void jit_compile(struct jit_t *jit, struct block_t *block)
+{
+    struct emitter_t e;
+    uint32_t pc = block->pc;
+    uint32_t i;
+
+    if (jit->code_used + JIT_MAX_BLOCK_CODE > JIT_CODE_SIZE)
+    {
+        /* Out of space: start over with a clean cache */
+        jit->cache->dirty = 1;
+        return;
+    }
+
+    e.p = jit->code + jit->code_used;
+    e.end_pc = block->pc + 4 * block->n_insns;
+    emit_prologue(&e);
+
+    for (i = 0; i < block->n_insns; i++, pc += 4)
+    {
+        if (emit_insn(&e, jit, &block->insns[i], pc))
+            break;
+    }
+
+    /* Block ended without a control transfer: continue after it */
+    if (i == block->n_insns)
+    {
+        emit_store_rbx_imm(&e, OFF_PC, pc);
+        emit_epilogue(&e);
+    }
+
+    block->native = (void (*)(struct minirisc_t *))(jit->code + jit->code_used);
+    jit->code_used = (e.p - jit->code + 15) & ~15;
+}
+
+#else
+
+struct jit_t *jit_new(struct block_cache_t *cache)
+{
+    (void)cache;
+    printf("The JIT is only available on x86-64 hosts.\n");
+    return NULL;
+}
+
+void jit_free(struct jit_t *jit)
+{
+    (void)jit;
+}
+
+void jit_flush(struct jit_t *jit)
+{
+    (void)jit;
+}
+
+void jit_compile(struct jit_t *jit, struct block_t *block)
+{
+    (void)jit;
+    (void)block;
+}
+
+#endif
@@ -1,34 +1,749 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
 
 #include "platform.h"
 #include "minirisc.h"
 #include "types.h"
+#include "elf_loader.h"
+#include "stats.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "trace.h"
+#include "vmctl.h"
+#include "checkpoint.h"
+#include "recorder.h"
+#include "mtimer.h"
+#include "ecall.h"
+#include "iothread.h"
+#include "hle.h"
 
-int main()
+#define DEFAULT_PROGRAM "embedded_software/build/esw.elf"
+#define EXIT_LIMIT 124 /* Same as timeout(1) */
+
+/**
+ * Parse a size such as "65536", "512K", "64M" or "1G".
+ * @return 0 if the string is not a valid size
+ */
+static uint32_t parse_size(const char *str)
+{
+    char *end;
+    unsigned long long size = strtoull(str, &end, 0);
+
+    switch (*end)
+    {
+    case 'G':
+        size <<= 10;
+        /* fall through */
+    case 'M':
+        size <<= 10;
+        /* fall through */
+    case 'K':
+        size <<= 10;
+        end++;
+        break;
+    }
+
+    if (end == str || *end != '\0' || size > UINT32_MAX)
+        return 0;
+
+    return size;
+}
+
+static struct iothread_t *io_at_exit;
+
+static void stop_io_at_exit()
+{
+    if (io_at_exit != NULL)
+        iothread_stop(io_at_exit);
+}
+
+static struct trace_t *trace_at_exit;
+
+static void close_trace_at_exit()
 {
+    if (trace_at_exit != NULL)
+        trace_close(trace_at_exit);
+}
+
+static struct recorder_t *recorder_at_exit;
+
+static void close_recorder_at_exit()
+{
+    if (recorder_at_exit != NULL)
+        recorder_close(recorder_at_exit);
+}
+
+/**
+ * Name of an output file of the forked VM vm_id: "name.vm_id".
+ */
+static const char *child_file(const char *name, int vm_id)
+{
+    char *child;
+
+    if (name == NULL)
+        return NULL;
+    if ((child = malloc(strlen(name) + 12)) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(child, "%s.%d", name, vm_id);
+
+    return child;
+}
+
+/**
+ * start + count, saturated: UINT64_MAX stays "no limit".
+ */
+static uint64_t add_count(uint64_t start, uint64_t count)
+{
+    return count > UINT64_MAX - start ? UINT64_MAX : start + count;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [options] [program]\n"
+           "\n"
+           "Run a MINIRISC program (ELF executable or raw binary loaded at RAM_BASE).\n"
+           "Default program: %s\n"
+           "\n"
+           "Options:\n"
+           "  -r, --ram SIZE              RAM size, bytes or K/M/G suffix (default 64M)\n"
+           "  -n, --max-instructions N    stop after N instructions (exit code %d)\n"
+           "  -e, --entry ADDR            start at ADDR instead of the ELF entry point / RAM_BASE\n"
+           "  -E, --engine NAME           interp (default), switch, threaded, block or jit\n"
+           "  -q, --quiet                 only print the guest output\n"
+           "  -O, --output-policy POLICY  when the guest prints faster than stdout takes it: block\n"
+           "                              (default, the VM waits) or drop (the output is lost)\n"
+           "  -H, --hle MODE              replace memcpy, strlen, __divdi3... by host routines: native,\n"
+           "                              or check (run both and stop at the first difference)\n"
+           "  -s, --stats-json FILE       write the run counters to FILE as JSON\n"
+           "  -p, --profile FILE          write an instruction profile by function to FILE\n"
+           "                              (interp, block and jit engines)\n"
+           "  -f, --folded FILE           write the folded call stacks to FILE, for flamegraph tools\n"
+           "  -t, --calltree FILE         write the call tree with inclusive/exclusive counts to FILE\n"
+           "                              (both: interp and block engines)\n"
+           "  -T, --trace FILE            write a binary instruction and memory trace to FILE\n"
+           "                              (interp engine, not with --hle, read it with trace_dump)\n"
+           "  -w, --record FILE           record the guest's framebuffer to FILE (a file prefix for ppm)\n"
+           "  -W, --record-format FMT     y4m (default), ppm (one file per frame) or rgba (raw)\n"
+           "  -k, --record-every N        record one frame out of N (default 1); frames the\n"
+           "                              writer thread cannot keep up with are dropped\n"
+           "  -m, --clock MODE            guest time: virtual (default, from the instruction count),\n"
+           "                              host (real time) or paced (virtual, slowed to real time)\n"
+           "  -M, --clock-freq HZ         instructions per second of the virtual clock (default %d)\n"
+           "  -S, --snapshot-at N         take the snapshot after N instructions\n"
+           "                              (default: when the guest writes the vmctl marker)\n"
+           "  -F, --fork N                at the snapshot, fork N copy-on-write copies of the VM\n"
+           "                              and wait for them; output files get a .ID suffix\n"
+           "  -c, --checkpoint FILE       at the snapshot, write a checkpoint to FILE and stop\n"
+           "  -z, --compress              compress the checkpoint pages (zlib)\n"
+           "  -R, --restore FILE          resume from a checkpoint instead of loading a program;\n"
+           "                              a program given too only provides the symbols\n"
+           "  -h, --help                  show this help\n"
+           "\n"
+           "The exit code is the guest's _exit() value, or %d if the guest faulted.\n",
+           name, DEFAULT_PROGRAM, EXIT_LIMIT, MTIMER_DEFAULT_FREQ, EXIT_FAILURE);
+}
+
+/**
+ * Command line of a run.
+ */
+struct options_t
+{
+    const char *program;
+    int program_set; /* Given on the command line, not the default */
+    const char *engine;
+    uint32_t ram_size;
+    uint64_t max_instret; /* Relative to the start of this run */
+    uint32_t entry;
+    int entry_set;
+    int quiet;
+    enum iothread_policy_t output_policy;
+    int hle;
+    enum hle_mode_t hle_mode;
+    const char *stats_file;
+    const char *profile_file;
+    const char *folded_file;
+    const char *calltree_file;
+    const char *trace_file;
+    const char *record_file;
+    enum recorder_format_t record_format;
+    uint32_t record_every;
+    enum mtimer_mode_t clock_mode;
+    uint64_t clock_freq;
+    uint64_t snapshot_at; /* Relative to the start of this run */
+    uint32_t fork_count;
+    const char *checkpoint_file;
+    int compress;
+    const char *restore_file;
+};
+
+/**
+ * Fill opts from the command line. --help prints the usage and exits.
+ * @return 0 on success, -1 if the command line is invalid
+ */
+static int parse_options(int argc, char *argv[], struct options_t *opts)
+{
+    static const struct option options[] = {
+        {"ram", required_argument, NULL, 'r'},
+        {"max-instructions", required_argument, NULL, 'n'},
+        {"entry", required_argument, NULL, 'e'},
+        {"engine", required_argument, NULL, 'E'},
+        {"quiet", no_argument, NULL, 'q'},
+        {"output-policy", required_argument, NULL, 'O'},
+        {"hle", required_argument, NULL, 'H'},
+        {"stats-json", required_argument, NULL, 's'},
+        {"profile", required_argument, NULL, 'p'},
+        {"folded", required_argument, NULL, 'f'},
+        {"calltree", required_argument, NULL, 't'},
+        {"trace", required_argument, NULL, 'T'},
+        {"record", required_argument, NULL, 'w'},
+        {"record-format", required_argument, NULL, 'W'},
+        {"record-every", required_argument, NULL, 'k'},
+        {"clock", required_argument, NULL, 'm'},
+        {"clock-freq", required_argument, NULL, 'M'},
+        {"snapshot-at", required_argument, NULL, 'S'},
+        {"fork", required_argument, NULL, 'F'},
+        {"checkpoint", required_argument, NULL, 'c'},
+        {"compress", no_argument, NULL, 'z'},
+        {"restore", required_argument, NULL, 'R'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    char *end;
+    int opt;
+
+    memset(opts, 0, sizeof(*opts));
+    opts->program = DEFAULT_PROGRAM;
+    opts->ram_size = PLATFORM_DEFAULT_RAM_SIZE;
+    opts->max_instret = UINT64_MAX;
+    opts->entry = RAM_BASE;
+    opts->output_policy = IOTHREAD_BLOCK;
+    opts->hle_mode = HLE_NATIVE;
+    opts->record_format = RECORDER_Y4M;
+    opts->record_every = 1;
+    opts->clock_mode = MTIMER_VIRTUAL;
+    opts->clock_freq = MTIMER_DEFAULT_FREQ;
+    opts->snapshot_at = UINT64_MAX;
+
+    while ((opt = getopt_long(argc, argv, "r:n:e:E:qO:H:s:p:f:t:T:w:W:k:m:M:S:F:c:zR:h", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            if ((opts->ram_size = parse_size(optarg)) == 0)
+            {
+                printf("Invalid RAM size: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'n':
+            opts->max_instret = strtoull(optarg, &end, 0);
+            if (end == optarg || *end != '\0')
+            {
+                printf("Invalid instruction count: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'e':
+            opts->entry = strtoul(optarg, &end, 0);
+            if (end == optarg || *end != '\0')
+            {
+                printf("Invalid entry point: %s\n", optarg);
+                return -1;
+            }
+            opts->entry_set = 1;
+            break;
+        case 'E':
+            opts->engine = optarg;
+            break;
+        case 'q':
+            opts->quiet = 1;
+            break;
+        case 'O':
+            if (iothread_parse_policy(optarg, &opts->output_policy) == -1)
+            {
+                printf("Unknown output policy: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'H':
+            if (hle_parse_mode(optarg, &opts->hle_mode) == -1)
+            {
+                printf("Unknown HLE mode: %s\n", optarg);
+                return -1;
+            }
+            opts->hle = 1;
+            break;
+        case 's':
+            opts->stats_file = optarg;
+            break;
+        case 'p':
+            opts->profile_file = optarg;
+            break;
+        case 'f':
+            opts->folded_file = optarg;
+            break;
+        case 't':
+            opts->calltree_file = optarg;
+            break;
+        case 'T':
+            opts->trace_file = optarg;
+            break;
+        case 'w':
+            opts->record_file = optarg;
+            break;
+        case 'W':
+            if (recorder_parse_format(optarg, &opts->record_format) == -1)
+            {
+                printf("Unknown recording format: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'k':
+            opts->record_every = strtoul(optarg, &end, 0);
+            if (end == optarg || *end != '\0' || opts->record_every == 0)
+            {
+                printf("Invalid frame interval: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'm':
+            if (mtimer_parse_mode(optarg, &opts->clock_mode) == -1)
+            {
+                printf("Unknown clock mode: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'M':
+            opts->clock_freq = strtoull(optarg, &end, 0);
+            if (end == optarg || *end != '\0' || opts->clock_freq == 0)
+            {
+                printf("Invalid clock frequency: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'S':
+            opts->snapshot_at = strtoull(optarg, &end, 0);
+            if (end == optarg || *end != '\0')
+            {
+                printf("Invalid instruction count: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'F':
+            opts->fork_count = strtoul(optarg, &end, 0);
+            if (end == optarg || *end != '\0' || opts->fork_count == 0)
+            {
+                printf("Invalid number of VMs: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'c':
+            opts->checkpoint_file = optarg;
+            break;
+        case 'z':
+            opts->compress = 1;
+            break;
+        case 'R':
+            opts->restore_file = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (optind < argc)
+    {
+        opts->program = argv[optind++];
+        opts->program_set = 1;
+    }
+    if (optind < argc)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (opts->checkpoint_file != NULL && opts->fork_count > 0)
+    {
+        printf("Write the checkpoint first, then fork from it with --restore.\n");
+        return -1;
+    }
+#ifndef MINIRISC_ZLIB
+    if (opts->compress)
+    {
+        printf("Compression needs an emulator built with zlib.\n");
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+/**
+ * Select the engine and attach the HLE hooks, the profile, the call
+ * graph, the trace and the recorder asked for by opts.
+ * @return -1 if a combination is not supported or a file cannot be opened
+ */
+static int attach_tools(struct minirisc_t *minirisc, struct elf_t *elf, const struct options_t *opts,
+                        struct recorder_t **recorder)
+{
+    struct platform_t *platform = minirisc->platform;
+
+    if (opts->engine != NULL && minirisc_set_engine(minirisc, opts->engine) == -1)
+    {
+        printf("Unknown engine: %s\n", opts->engine);
+        return -1;
+    }
+
+    if (opts->hle)
+    {
+        if (elf == NULL)
+        {
+            printf("HLE needs the symbols of an ELF program.\n");
+            return -1;
+        }
+        /* Before the first instruction is decoded */
+        minirisc->hle = hle_new(minirisc, elf, opts->hle_mode);
+        if (!opts->quiet)
+            printf("HLE hooks: %u\n", minirisc->hle->n_hooks);
+    }
+
+    if (opts->profile_file != NULL)
+    {
+        if (minirisc->engine != ENGINE_INTERP && minirisc->engine != ENGINE_BLOCK && minirisc->engine != ENGINE_JIT)
+        {
+            printf("Profiling needs the interp, block or jit engine.\n");
+            return -1;
+        }
+        minirisc->profile = profile_new(platform->size);
+    }
+
+    if (opts->folded_file != NULL || opts->calltree_file != NULL)
+    {
+        /* The JIT and the threaded loop inline JAL/JALR, only the handlers see the calls */
+        if (minirisc->engine != ENGINE_INTERP && minirisc->engine != ENGINE_BLOCK)
+        {
+            printf("Call stacks need the interp or block engine.\n");
+            return -1;
+        }
+        minirisc->callgraph = callgraph_new(minirisc->PC, minirisc->instret);
+    }
+
+    if (opts->trace_file != NULL)
+    {
+        if (minirisc->engine != ENGINE_INTERP)
+        {
+            printf("Tracing needs the interp engine.\n");
+            return -1;
+        }
+        /* The host routines access guest memory without going through the traced loads and stores */
+        if (minirisc->hle != NULL)
+        {
+            printf("Tracing and HLE cannot be combined.\n");
+            return -1;
+        }
+        if ((minirisc->trace = trace_open(opts->trace_file, minirisc->PC, platform->io)) == NULL)
+            return -1;
+        /* Faults exit() from the platform: keep the trace up to the faulting instruction */
+        trace_at_exit = minirisc->trace;
+        atexit(close_trace_at_exit);
+    }
+
+    if (opts->record_file != NULL)
+    {
+        if ((*recorder = recorder_open(platform->framebuffer, opts->record_file, opts->record_format,
+                                       opts->record_every)) == NULL)
+            return -1;
+        recorder_at_exit = *recorder;
+        atexit(close_recorder_at_exit);
+    }
+
+    return 0;
+}
+
+/**
+ * Have minirisc_run() stop at the snapshot point when a fork or a
+ * checkpoint is asked for: the vmctl marker, or snapshot_at.
+ * @return -1 if the snapshot cannot be combined with the other options
+ */
+static int prepare_snapshot(struct minirisc_t *minirisc, struct vmctl_t *vmctl, const struct recorder_t *recorder,
+                            const struct options_t *opts, uint64_t snapshot_at)
+{
+    if (opts->fork_count == 0 && opts->checkpoint_file == NULL)
+        return 0;
+
+    /* The forked VMs would all write to the same trace or recording file */
+    if (opts->fork_count > 0 && minirisc->trace != NULL)
+    {
+        printf("Tracing and forking cannot be combined.\n");
+        return -1;
+    }
+    if (opts->fork_count > 0 && recorder != NULL)
+    {
+        printf("Recording and forking cannot be combined.\n");
+        return -1;
+    }
+    vmctl->stop_at_marker = 1;
+    if (snapshot_at < minirisc->max_instret)
+        minirisc->max_instret = snapshot_at;
+
+    return 0;
+}
+
+/**
+ * Snapshot point, after the first minirisc_run(): a checkpoint stops the
+ * VM; forked children resume the guest with their own output files, the
+ * parent only waits for them.
+ * @return -1 when this process goes on to the end-of-run report, or the
+ * exit code of the process (checkpoint error, parent of the forked VMs)
+ */
+static int take_snapshot(struct minirisc_t *minirisc, struct vmctl_t *vmctl, struct options_t *opts,
+                         uint64_t snapshot_at, uint64_t max_instret, int *checkpointed)
+{
+    pid_t *pids;
+    int *statuses;
+    int vm_id;
+    int status;
+    uint32_t i;
+
+    if (opts->fork_count == 0 && opts->checkpoint_file == NULL)
+        return -1;
+    if (!vmctl_take_marker(vmctl) && (minirisc->halt || minirisc->instret != snapshot_at))
+        return -1;
+
+    if (opts->checkpoint_file != NULL)
+    {
+        if (checkpoint_write(minirisc, opts->checkpoint_file, opts->compress) == -1)
+            return EXIT_FAILURE;
+        *checkpointed = 1;
+        return -1;
+    }
+
+    vmctl->stop_at_marker = 0;
+    minirisc->max_instret = max_instret;
+    if (!opts->quiet)
+        printf("\nForking %u VMs at PC %08x after %" PRIu64 " instructions\n", opts->fork_count, minirisc->PC,
+               minirisc->instret);
+    if ((pids = malloc(opts->fork_count * sizeof(pid_t))) == NULL ||
+        (statuses = malloc(opts->fork_count * sizeof(int))) == NULL)
+    {
+        printf("Malloc error.\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((vm_id = vm_fork(vmctl, opts->fork_count, pids)) == -1)
+    {
+        vm_wait(pids, opts->fork_count, statuses);
+        status = EXIT_SUCCESS;
+        for (i = 0; i < opts->fork_count; i++)
+        {
+            if (!opts->quiet)
+                printf("VM %u (pid %d) exited with %d\n", i, (int)pids[i], statuses[i]);
+            if (status == EXIT_SUCCESS)
+                status = statuses[i];
+        }
+        return status;
+    }
+
+    opts->stats_file = child_file(opts->stats_file, vm_id);
+    opts->profile_file = child_file(opts->profile_file, vm_id);
+    opts->folded_file = child_file(opts->folded_file, vm_id);
+    opts->calltree_file = child_file(opts->calltree_file, vm_id);
+    minirisc_run(minirisc);
+    iothread_sync(minirisc->platform->io);
+
+    return -1;
+}
+
+/**
+ * Print the end-of-run report, write the output files and close the
+ * trace and the recording.
+ * @return the exit code: the guest's, EXIT_FAILURE on a fault or when an
+ * output file cannot be written, EXIT_LIMIT at the instruction limit
+ */
+static int finish_run(struct minirisc_t *minirisc, struct elf_t *elf, struct recorder_t *recorder,
+                      const struct options_t *opts, int checkpointed, double seconds)
+{
+    struct platform_t *platform = minirisc->platform;
+    int status;
+
+    if (checkpointed)
+        status = EXIT_SUCCESS;
+    else if (minirisc->exited)
+        status = minirisc->exit_code & 0xFF;
+    else if (minirisc->halt)
+        status = EXIT_FAILURE;
+    else
+        status = EXIT_LIMIT;
+
+    if (!opts->quiet)
+    {
+        if (checkpointed)
+            printf("\nCheckpoint written to %s at PC %08x after %" PRIu64 " instructions", opts->checkpoint_file,
+                   minirisc->PC, minirisc->instret);
+        else if (status == EXIT_LIMIT && !minirisc->exited)
+            printf("\nInstruction limit reached (%" PRIu64 ") at PC %08x", minirisc->instret, minirisc->PC);
+        printf("\n---------------------\n\nVM STOPPED \n");
+        stats_print(minirisc, seconds);
+        if (recorder != NULL)
+            printf("Frames recorded      : %" PRIu64 " (%" PRIu64 " dropped)\n", recorder->captured,
+                   recorder->dropped);
+        if (platform->io->dropped > 0)
+            printf("Output dropped       : %" PRIu64 " bytes\n", platform->io->dropped);
+    }
+    if (opts->stats_file != NULL && stats_write_json(minirisc, seconds, opts->stats_file) == -1)
+        status = EXIT_FAILURE;
+    if (minirisc->profile != NULL)
+    {
+        if (profile_write_report(minirisc->profile, elf, opts->profile_file) == -1)
+            status = EXIT_FAILURE;
+        profile_free(minirisc->profile);
+    }
+    if (minirisc->trace != NULL)
+    {
+        trace_at_exit = NULL;
+        if (trace_close(minirisc->trace) == -1)
+            status = EXIT_FAILURE;
+    }
+    if (recorder != NULL)
+    {
+        recorder_at_exit = NULL;
+        if (recorder_close(recorder) == -1)
+            status = EXIT_FAILURE;
+    }
+    if (minirisc->callgraph != NULL)
+    {
+        callgraph_finish(minirisc->callgraph, minirisc->instret);
+        if (opts->folded_file != NULL && callgraph_write_folded(minirisc->callgraph, elf, opts->folded_file) == -1)
+            status = EXIT_FAILURE;
+        if (opts->calltree_file != NULL && callgraph_write_tree(minirisc->callgraph, elf, opts->calltree_file) == -1)
+            status = EXIT_FAILURE;
+        callgraph_free(minirisc->callgraph);
+    }
+
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    struct options_t opts;
     struct platform_t *platform;
     struct minirisc_t *minirisc;
+    struct elf_t *elf;
+    struct vmctl_t *vmctl;
+    struct checkpoint_t *checkpoint = NULL;
+    struct recorder_t *recorder = NULL;
+    uint32_t ram_size;
+    uint32_t entry;
+    uint64_t max_instret;
+    uint64_t snapshot_at;
+    int checkpointed = 0;
+    struct timespec start, stop;
+    double seconds;
+    int status;
 
-    printf("Creating platform...\n");
-    platform = platform_new();
+    if (parse_options(argc, argv, &opts) == -1)
+        return EXIT_FAILURE;
+    ram_size = opts.ram_size;
+    entry = opts.entry;
 
-    printf("Creating minirisc...\n");
-    minirisc = minirisc_new(RAM_BASE, platform);
+    if (opts.restore_file != NULL)
+    {
+        /* The checkpoint gives the RAM size, its content and the registers */
+        checkpoint = checkpoint_open(opts.restore_file);
+        ram_size = checkpoint->header.ram_size;
+        if (!opts.entry_set)
+            entry = checkpoint->header.pc;
+    }
 
-    printf("Loading program...\n");
-    platform_load_program(platform, "embedded_software/build/esw.bin");
+    if (!opts.quiet)
+        printf("Creating platform...\n");
+    platform = platform_new(ram_size);
+    platform->io->policy = opts.output_policy;
+    /* Faults exit() from the emulation thread: write the output posted before */
+    io_at_exit = platform->io;
+    atexit(stop_io_at_exit);
 
-    printf("Starting VM...\n");
+    /* ELF files are mapped at their addresses, raw binaries are copied at RAM_BASE */
+    if (!opts.quiet)
+        printf("Loading program...\n");
+    if (checkpoint != NULL)
+        elf = opts.program_set ? elf_open(opts.program) : NULL;
+    else if ((elf = elf_open(opts.program)) != NULL)
+    {
+        elf_load(elf, platform);
+        if (!opts.entry_set)
+            entry = elf->entry;
+    }
+    else
+        platform_load_program(platform, opts.program);
 
-    printf("First instruction at RAM_BASE: %08x\n", platform->memory[0]);
-    printf("Stack top should be at: %08x\n", RAM_BASE + platform->size - 16);
+    if (entry - RAM_BASE >= platform->size)
+    {
+        printf("Entry point %08x is outside RAM (%08x - %08x)\n", entry, RAM_BASE, RAM_BASE + platform->size - 1);
+        return EXIT_FAILURE;
+    }
+
+    if (!opts.quiet)
+        printf("Creating minirisc...\n");
+    minirisc = minirisc_new(entry, platform);
+    minirisc->timer = mtimer_new(minirisc, opts.clock_mode, opts.clock_freq);
+    minirisc->ecall = ecall_new(minirisc);
+    if (checkpoint != NULL)
+    {
+        checkpoint_load(checkpoint, minirisc);
+        checkpoint_close(checkpoint);
+        minirisc->PC = entry;
+        minirisc->stats.start_instret = minirisc->instret;
+    }
+
+    /* Instruction counts are relative to the start of this run */
+    max_instret = add_count(minirisc->instret, opts.max_instret);
+    snapshot_at = add_count(minirisc->instret, opts.snapshot_at);
+    minirisc->max_instret = max_instret;
+    vmctl = vmctl_new(minirisc);
+
+    if (attach_tools(minirisc, elf, &opts, &recorder) == -1 ||
+        prepare_snapshot(minirisc, vmctl, recorder, &opts, snapshot_at) == -1)
+        return EXIT_FAILURE;
+
+    if (!opts.quiet)
+    {
+        printf("Starting VM...\n");
+        printf("Entry point: %08x\n", entry);
+        printf("Stack top should be at: %08x\n", RAM_BASE + platform->size - 16);
+    }
     fflush(stdout);
+    mtimer_start(minirisc->timer);
+    clock_gettime(CLOCK_MONOTONIC, &start);
     minirisc_run(minirisc);
+    iothread_sync(platform->io);
 
+    if ((status = take_snapshot(minirisc, vmctl, &opts, snapshot_at, max_instret, &checkpointed)) != -1)
+        return status;
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+    status = finish_run(minirisc, elf, recorder, &opts, checkpointed, seconds);
+
+    vmctl_free(vmctl);
+    mtimer_free(minirisc->timer);
+    ecall_free(minirisc->ecall);
+    if (minirisc->hle != NULL)
+        hle_free(minirisc->hle);
     minirisc_free(minirisc);
+    if (elf != NULL)
+        elf_close(elf);
+    io_at_exit = NULL;
     platform_free(platform);
 
-    printf("\n---------------------\n\nVM STOPPED \n");
-
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
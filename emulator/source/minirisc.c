@@ -1,9 +1,23 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "types.h"
 #include "minirisc.h"
 #include "platform.h"
+#include "icache.h"
+#include "block.h"
+#include "jit.h"
+#include "threaded.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "trace.h"
+#include "ecall.h"
+#include "iothread.h"
+#include "hle.h"
+#include "fpu.h"
+
+static void minirisc_code_write(void *opaque, uint32_t addr, uint32_t len);
 
 struct minirisc_t *minirisc_new(uint32_t initial_PC, struct platform_t *platform)
 {
@@ -19,503 +33,667 @@ struct minirisc_t *minirisc_new(uint32_t initial_PC, struct platform_t *platform
     cpu->next_PC = initial_PC;
     cpu->platform = platform;
     cpu->regs[0] = 0;
+    memset(cpu->fregs, 0, sizeof(cpu->fregs));
+    cpu->fcsr = 0;
     cpu->halt = 0;
-
-    /* Should I use platform_read ? */
-    cpu->IR = platform->memory[initial_PC - RAM_BASE];
+    cpu->instret = 0;
+    cpu->max_instret = UINT64_MAX;
+    cpu->exited = 0;
+    cpu->exit_code = 0;
+    memset(&cpu->stats, 0, sizeof(cpu->stats));
+    cpu->profile = NULL;
+    cpu->callgraph = NULL;
+    cpu->trace = NULL;
+    cpu->timer = NULL;
+    cpu->ecall = NULL;
+    cpu->hle = NULL;
+    cpu->engine = ENGINE_INTERP;
+    cpu->blocks = NULL;
+    cpu->IR = 0; /* Every engine fetches its first instruction at PC */
+
+    if ((cpu->icache = icache_new(cpu)) == NULL)
+    {
+        free(cpu);
+        return NULL;
+    }
+    platform_set_code_write_hook(platform, minirisc_code_write, cpu);
 
     return cpu;
 }
 
 void minirisc_free(struct minirisc_t *minirisc)
 {
+    platform_set_code_write_hook(minirisc->platform, NULL, NULL);
+    icache_free(minirisc->icache);
+    if (minirisc->blocks)
+        block_cache_free(minirisc->blocks);
     free(minirisc);
 }
 
-void minirisc_fetch(struct minirisc_t *minirisc)
+static void minirisc_code_write(void *opaque, uint32_t addr, uint32_t len)
 {
-    platform_read(minirisc->platform, ACCESS_WORD, minirisc->PC, &minirisc->IR);
+    struct minirisc_t *minirisc = opaque;
+
+    icache_invalidate(minirisc->icache, addr, len);
+    if (minirisc->blocks)
+        minirisc->blocks->dirty = 1;
 }
 
-void minirisc_decode_and_execute(struct minirisc_t *minirisc)
+int minirisc_set_engine(struct minirisc_t *minirisc, const char *name)
 {
-    uint32_t instr = minirisc->IR;
-
-    uint32_t opcode = instr & 0x7F;
-
-    uint32_t rd = (instr >> 7) & 0x1F;
-    uint32_t rs1 = (instr >> 12) & 0x1F;
-    uint32_t rs2 = (instr >> 17) & 0x1F;
-
-    uint32_t imm = (instr >> 20) & 0xFFF;
-    uint32_t imm_lui = (instr >> 12) & 0xFFFFF;
-
-    uint32_t shamt = (instr >> 20) & 0x1F;
-
-    minirisc->next_PC = minirisc->PC + 4;
-
-    switch (opcode)
+    if (strcmp(name, "interp") == 0)
     {
-    case LUI_CODE:
+        minirisc->engine = ENGINE_INTERP;
+    }
+    else if (strcmp(name, "switch") == 0)
     {
-        uint32_t value = imm_lui << 12;
-        set_reg(minirisc, rd, value);
-        break;
+        minirisc->engine = ENGINE_SWITCH;
     }
-    case AUIPC_CODE:
+    else if (strcmp(name, "threaded") == 0)
     {
-        uint32_t value = minirisc->PC + (imm_lui << 12);
-        set_reg(minirisc, rd, value);
-        break;
+        minirisc->engine = ENGINE_THREADED;
     }
-    case JAL_CODE:
+    else if (strcmp(name, "block") == 0)
     {
-        imm_lui <<= 1;
-        extend_sign(&imm_lui, 20);
-
-        uint32_t target = minirisc->PC + imm_lui;
-        uint32_t value = minirisc->PC + 4;
-        set_reg(minirisc, rd, value);
-
-        minirisc->next_PC = target;
-        break;
+        if (minirisc->blocks == NULL && (minirisc->blocks = block_cache_new()) == NULL)
+            return -1;
+        minirisc->engine = ENGINE_BLOCK;
     }
-    case JALR_CODE:
+    else if (strcmp(name, "jit") == 0)
     {
-        extend_sign(&imm, 11);
-
-        uint32_t target = minirisc->regs[rs1] + imm;
-        target &= ~0x1; /* LSB à 0 */
-        uint32_t value = minirisc->PC + 4;
-        set_reg(minirisc, rd, value);
-
-        minirisc->next_PC = target;
-        break;
+        if (minirisc->blocks == NULL && (minirisc->blocks = block_cache_new()) == NULL)
+            return -1;
+        if (minirisc->blocks->jit == NULL && (minirisc->blocks->jit = jit_new(minirisc->blocks)) == NULL)
+            return -1;
+        minirisc->engine = ENGINE_JIT;
     }
-    case BEQ_CODE:
+    else
     {
-        imm <<= 1;
-        extend_sign(&imm, 12);
+        return -1;
+    }
 
-        uint32_t target = minirisc->PC + imm;
+    return 0;
+}
 
-        if ((int32_t)minirisc->regs[rs1] == (int32_t)minirisc->regs[rd])
-        {
-            minirisc->next_PC = target;
-        }
-        break;
-    }
-    case BNE_CODE:
-    {
-        imm <<= 1;
-        extend_sign(&imm, 12);
+void minirisc_fetch(struct minirisc_t *minirisc)
+{
+    platform_read(minirisc->platform, ACCESS_WORD, minirisc->PC, &minirisc->IR);
+}
 
-        uint32_t target = minirisc->PC + imm;
+/* ------------------------------------------------------------------------- */
+/* Instruction handlers                                                       */
+/* Each handler executes one decoded instruction. next_PC is already PC + 4.  */
+/* ------------------------------------------------------------------------- */
 
-        if ((int32_t)minirisc->regs[rs1] != (int32_t)minirisc->regs[rd])
-        {
-            minirisc->next_PC = target;
-        }
-        break;
-    }
-    case BLT_CODE:
-    {
-        imm <<= 1;
-        extend_sign(&imm, 12);
+static void exec_lui(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, insn->imm);
+}
 
-        uint32_t target = minirisc->PC + imm;
+static void exec_auipc(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->PC + insn->imm);
+}
 
-        if ((int32_t)minirisc->regs[rs1] < (int32_t)minirisc->regs[rd])
-        {
-            minirisc->next_PC = target;
-        }
-        break;
-    }
-    case BGE_CODE:
-    {
-        imm <<= 1;
-        extend_sign(&imm, 12);
+static void exec_jal(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t target = minirisc->PC + insn->imm;
 
-        uint32_t target = minirisc->PC + imm;
+    set_reg(minirisc, insn->rd, minirisc->PC + 4);
+    minirisc->next_PC = target;
+    if (minirisc->callgraph && insn->rd == 1)
+        callgraph_call(minirisc->callgraph, target, minirisc->PC + 4, minirisc->instret + 1);
+}
 
-        if ((int32_t)minirisc->regs[rs1] >= (int32_t)minirisc->regs[rd])
-        {
-            minirisc->next_PC = target;
-        }
-        break;
-    }
-    case BLTU_CODE:
+static void exec_jalr(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t target = (minirisc->regs[insn->rs1] + insn->imm) & ~0x1; /* LSB à 0 */
+
+    set_reg(minirisc, insn->rd, minirisc->PC + 4);
+    minirisc->next_PC = target;
+    if (minirisc->callgraph)
     {
-        imm <<= 1;
-        extend_sign(&imm, 12);
+        /* jalr ra, ...: call; jalr x0, 0(ra): return */
+        if (insn->rd == 1)
+            callgraph_call(minirisc->callgraph, target, minirisc->PC + 4, minirisc->instret + 1);
+        else if (insn->rd == 0 && insn->rs1 == 1 && insn->imm == 0)
+            callgraph_return(minirisc->callgraph, target, minirisc->instret + 1);
+    }
+}
 
-        uint32_t target = minirisc->PC + imm;
+/* Branches compare rs1 with the register held in the rd field */
+static inline void branch(struct minirisc_t *minirisc, struct insn_t *insn, int taken)
+{
+    STATS_ADD(minirisc->stats.branches_taken, taken);
+    STATS_ADD(minirisc->stats.branches_not_taken, !taken);
+    if (taken)
+        minirisc->next_PC = minirisc->PC + insn->imm;
+}
 
-        if (minirisc->regs[rs1] < minirisc->regs[rd])
-        {
-            minirisc->next_PC = target;
-        }
-        break;
-    }
-    case BGEU_CODE:
-    {
-        imm <<= 1;
-        extend_sign(&imm, 12);
+static void exec_beq(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    branch(minirisc, insn, (int32_t)minirisc->regs[insn->rs1] == (int32_t)minirisc->regs[insn->rd]);
+}
 
-        uint32_t target = minirisc->PC + imm;
+static void exec_bne(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    branch(minirisc, insn, (int32_t)minirisc->regs[insn->rs1] != (int32_t)minirisc->regs[insn->rd]);
+}
 
-        if (minirisc->regs[rs1] >= minirisc->regs[rd])
-        {
-            minirisc->next_PC = target;
-        }
+static void exec_blt(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    branch(minirisc, insn, (int32_t)minirisc->regs[insn->rs1] < (int32_t)minirisc->regs[insn->rd]);
+}
 
-        break;
-    }
-    case LB_CODE:
-    {
-        extend_sign(&imm, 11);
-        uint32_t mem_addr = minirisc->regs[rs1] + imm;
+static void exec_bge(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    branch(minirisc, insn, (int32_t)minirisc->regs[insn->rs1] >= (int32_t)minirisc->regs[insn->rd]);
+}
 
-        platform_read(minirisc->platform, ACCESS_BYTE, mem_addr, &minirisc->regs[rd]);
-        extend_sign(&minirisc->regs[rd], 7);
-        break;
-    }
-    case LH_CODE:
-    {
-        extend_sign(&imm, 11);
-        uint32_t target = minirisc->regs[rs1] + imm;
+static void exec_bltu(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    branch(minirisc, insn, minirisc->regs[insn->rs1] < minirisc->regs[insn->rd]);
+}
 
-        platform_read(minirisc->platform, ACCESS_HALF, target, &minirisc->regs[rd]);
-        extend_sign(&minirisc->regs[rd], 15);
-        break;
-    }
-    case LW_CODE:
-    {
-        extend_sign(&imm, 11);
-        uint32_t target_data = minirisc->regs[rs1] + imm;
+static void exec_bgeu(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    branch(minirisc, insn, minirisc->regs[insn->rs1] >= minirisc->regs[insn->rd]);
+}
 
-        if (platform_read(minirisc->platform, ACCESS_WORD, target_data, &minirisc->regs[rd]) == -1)
-        {
-            minirisc->halt = 1;
-            break;
-        }
-        break;
-    }
-    case LBU_CODE:
-    {
-        extend_sign(&imm, 11);
-        uint32_t mem_addr = minirisc->regs[rs1] + imm;
+/* Guest loads and stores: counted, traced, then done through the platform */
+static inline int load(struct minirisc_t *minirisc, enum access_type_t type, uint32_t addr, uint32_t *data)
+{
+    STATS_INC(minirisc->stats.loads);
+    if (minirisc->trace)
+        trace_access(minirisc->trace, TRACE_LOAD, addr, type);
+    return platform_read(minirisc->platform, type, addr, data);
+}
 
-        platform_read(minirisc->platform, ACCESS_BYTE, mem_addr, &minirisc->regs[rd]);
-        minirisc->regs[rd] &= 0xFF;
-        break;
-    }
-    case LHU_CODE:
-    {
-        extend_sign(&imm, 11);
-        uint32_t target = minirisc->regs[rs1] + imm;
+static inline int store(struct minirisc_t *minirisc, enum access_type_t type, uint32_t addr, uint32_t data)
+{
+    STATS_INC(minirisc->stats.stores);
+    if (minirisc->trace)
+        trace_access(minirisc->trace, TRACE_STORE, addr, type);
+    return platform_write(minirisc->platform, type, addr, data);
+}
 
-        platform_read(minirisc->platform, ACCESS_HALF, target, &minirisc->regs[rd]);
-        minirisc->regs[rd] &= 0xFFFF;
-        break;
-    }
-    case SB_CODE:
-    {
-        extend_sign(&imm, 11);
-        uint32_t addr = minirisc->regs[rs1] + imm;
+int minirisc_load(struct minirisc_t *minirisc, enum access_type_t type, uint32_t addr, uint32_t *data)
+{
+    return load(minirisc, type, addr, data);
+}
 
-        platform_write(minirisc->platform, ACCESS_BYTE, addr, minirisc->regs[rd]);
-        break;
-    }
-    case SH_CODE:
-    {
-        extend_sign(&imm, 11);
-        uint32_t addr = minirisc->regs[rs1] + imm;
-        uint32_t data = minirisc->regs[rd];
+int minirisc_store(struct minirisc_t *minirisc, enum access_type_t type, uint32_t addr, uint32_t data)
+{
+    return store(minirisc, type, addr, data);
+}
 
-        platform_write(minirisc->platform, ACCESS_HALF, addr, data);
-        break;
-    }
-    case SW_CODE:
-    {
-        extend_sign(&imm, 11);
-        uint32_t addr = minirisc->regs[rs1] + imm;
-        uint32_t data = minirisc->regs[rd];
+static void exec_lb(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t data;
 
-        platform_write(minirisc->platform, ACCESS_WORD, addr, data);
-        break;
-    }
-    case ADDI_CODE:
+    if (load(minirisc, ACCESS_BYTE, minirisc->regs[insn->rs1] + insn->imm, &data) == -1)
     {
-        extend_sign(&imm, 11);
-        uint32_t value = minirisc->regs[rs1] + imm;
-        set_reg(minirisc, rd, value);
-        break;
+        minirisc->halt = 1;
+        return;
     }
-    case SLTI_CODE:
-    {
-        extend_sign(&imm, 11);
+    extend_sign(&data, 7);
+    set_reg(minirisc, insn->rd, data);
+}
 
-        if ((int32_t)minirisc->regs[rs1] < (int32_t)imm)
-        {
-            uint32_t value = 1;
-            set_reg(minirisc, rd, value);
-        }
-        else
-        {
-            uint32_t value = 0;
-            set_reg(minirisc, rd, value);
-        }
-        break;
-    }
-    case SLTIU_CODE:
-    {
-        extend_sign(&imm, 11);
+static void exec_lh(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t data;
 
-        if (minirisc->regs[rs1] < (uint32_t)imm)
-        {
-            uint32_t value = 1;
-            set_reg(minirisc, rd, value);
-        }
-        else
-        {
-            uint32_t value = 0;
-            set_reg(minirisc, rd, value);
-        }
-        break;
-    }
-    case XORI_CODE:
+    if (load(minirisc, ACCESS_HALF, minirisc->regs[insn->rs1] + insn->imm, &data) == -1)
     {
-        extend_sign(&imm, 11);
-
-        uint32_t value = (minirisc->regs[rs1] & (0xFFFFFFFF - imm)) | ((0xFFFFFFFF - minirisc->regs[rs1]) & imm);
-        set_reg(minirisc, rd, value);
-        break;
+        minirisc->halt = 1;
+        return;
     }
-    case ORI_CODE:
-    {
-        extend_sign(&imm, 11);
+    extend_sign(&data, 15);
+    set_reg(minirisc, insn->rd, data);
+}
 
-        uint32_t value = minirisc->regs[rs1] | imm;
-        set_reg(minirisc, rd, value);
-        break;
-    }
-    case ANDI_CODE:
-    {
-        extend_sign(&imm, 11);
+static void exec_lw(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t data;
 
-        uint32_t value = minirisc->regs[rs1] & imm;
-        set_reg(minirisc, rd, value);
-        break;
-    }
-    case SLLI_CODE:
-    {
-        uint32_t value = minirisc->regs[rs1] << shamt;
-        set_reg(minirisc, rd, value);
-        break;
-    }
-    case SRLI_CODE:
-    {
-        uint32_t value = minirisc->regs[rs1] >> shamt;
-        set_reg(minirisc, rd, value);
-        break;
-    }
-    case SRAI_CODE:
-    {
-        uint32_t value = (uint32_t)((int32_t)minirisc->regs[rs1] >> shamt);
-        set_reg(minirisc, rd, value);
-        break;
-    }
-    case ADD_CODE:
-    {
-        uint32_t value = minirisc->regs[rs1] + minirisc->regs[rs2];
-        set_reg(minirisc, rd, value);
-        break;
-    }
-    case SUB_CODE:
+    if (load(minirisc, ACCESS_WORD, minirisc->regs[insn->rs1] + insn->imm, &data) == -1)
     {
-        uint32_t value = minirisc->regs[rs1] - minirisc->regs[rs2];
-        set_reg(minirisc, rd, value);
-        break;
-    }
-    case SLL_CODE:
-    {
-        uint32_t value = minirisc->regs[rs1] << (minirisc->regs[rs2] & 0x1F);
-        set_reg(minirisc, rd, value);
-        break;
-    }
-    case SRL_CODE:
-    {
-        uint32_t value = minirisc->regs[rs1] >> (minirisc->regs[rs2] & 0x1F);
-        set_reg(minirisc, rd, value);
-        break;
-    }
-    case SRA_CODE:
-    {
-        uint32_t value = (uint32_t)((int32_t)minirisc->regs[rs1] >> (minirisc->regs[rs2] & 0x1F));
-        set_reg(minirisc, rd, value);
-        break;
-    }
-    case SLT_CODE:
-    {
-        if ((int32_t)minirisc->regs[rs1] < (int32_t)minirisc->regs[rs2])
-        {
-            uint32_t value = 1;
-            set_reg(minirisc, rd, value);
-        }
-        else
-        {
-            uint32_t value = 0;
-            set_reg(minirisc, rd, value);
-        }
-        break;
-    }
-    case SLTU_CODE:
-    {
-        if (minirisc->regs[rs1] < minirisc->regs[rs2])
-        {
-            uint32_t value = 1;
-            set_reg(minirisc, rd, value);
-        }
-        else
-        {
-            uint32_t value = 0;
-            set_reg(minirisc, rd, value);
-        }
-        break;
-    }
-    case XOR_CODE:
-    {
-        uint32_t value = (minirisc->regs[rs1] & (0xFFFFFFFF - minirisc->regs[rs2])) | ((0xFFFFFFFF - minirisc->regs[rs1]) & minirisc->regs[rs2]);
-        set_reg(minirisc, rd, value);
-        break;
+        minirisc->halt = 1;
+        return;
     }
-    case OR_CODE:
+    set_reg(minirisc, insn->rd, data);
+}
+
+static void exec_lbu(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t data;
+
+    if (load(minirisc, ACCESS_BYTE, minirisc->regs[insn->rs1] + insn->imm, &data) == -1)
     {
-        uint32_t value = minirisc->regs[rs1] | minirisc->regs[rs2];
-        set_reg(minirisc, rd, value);
-        break;
+        minirisc->halt = 1;
+        return;
     }
-    case AND_CODE:
+    set_reg(minirisc, insn->rd, data & 0xFF);
+}
+
+static void exec_lhu(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t data;
+
+    if (load(minirisc, ACCESS_HALF, minirisc->regs[insn->rs1] + insn->imm, &data) == -1)
     {
-        uint32_t value = minirisc->regs[rs1] & minirisc->regs[rs2];
-        set_reg(minirisc, rd, value);
-        break;
+        minirisc->halt = 1;
+        return;
     }
-    case ECALL_CODE:
-    {
+    set_reg(minirisc, insn->rd, data & 0xFFFF);
+}
+
+/* Stores write the register held in the rd field */
+static void exec_sb(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    if (store(minirisc, ACCESS_BYTE, minirisc->regs[insn->rs1] + insn->imm, minirisc->regs[insn->rd]) == -1)
+        minirisc->halt = 1;
+}
+
+static void exec_sh(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    if (store(minirisc, ACCESS_HALF, minirisc->regs[insn->rs1] + insn->imm, minirisc->regs[insn->rd]) == -1)
+        minirisc->halt = 1;
+}
+
+static void exec_sw(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    if (store(minirisc, ACCESS_WORD, minirisc->regs[insn->rs1] + insn->imm, minirisc->regs[insn->rd]) == -1)
+        minirisc->halt = 1;
+}
+
+static void exec_addi(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->regs[insn->rs1] + insn->imm);
+}
+
+static void exec_slti(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, (int32_t)minirisc->regs[insn->rs1] < (int32_t)insn->imm);
+}
+
+static void exec_sltiu(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->regs[insn->rs1] < insn->imm);
+}
+
+static void exec_xori(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->regs[insn->rs1] ^ insn->imm);
+}
+
+static void exec_ori(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->regs[insn->rs1] | insn->imm);
+}
+
+static void exec_andi(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->regs[insn->rs1] & insn->imm);
+}
+
+/* For shifts by immediate, imm holds shamt */
+static void exec_slli(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->regs[insn->rs1] << insn->imm);
+}
+
+static void exec_srli(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->regs[insn->rs1] >> insn->imm);
+}
+
+static void exec_srai(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, (uint32_t)((int32_t)minirisc->regs[insn->rs1] >> insn->imm));
+}
+
+static void exec_add(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->regs[insn->rs1] + minirisc->regs[insn->rs2]);
+}
+
+static void exec_sub(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->regs[insn->rs1] - minirisc->regs[insn->rs2]);
+}
+
+static void exec_sll(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->regs[insn->rs1] << (minirisc->regs[insn->rs2] & 0x1F));
+}
+
+static void exec_srl(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->regs[insn->rs1] >> (minirisc->regs[insn->rs2] & 0x1F));
+}
+
+static void exec_sra(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, (uint32_t)((int32_t)minirisc->regs[insn->rs1] >> (minirisc->regs[insn->rs2] & 0x1F)));
+}
+
+static void exec_slt(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, (int32_t)minirisc->regs[insn->rs1] < (int32_t)minirisc->regs[insn->rs2]);
+}
+
+static void exec_sltu(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->regs[insn->rs1] < minirisc->regs[insn->rs2]);
+}
+
+static void exec_xor(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->regs[insn->rs1] ^ minirisc->regs[insn->rs2]);
+}
+
+static void exec_or(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->regs[insn->rs1] | minirisc->regs[insn->rs2]);
+}
+
+static void exec_and(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->regs[insn->rs1] & minirisc->regs[insn->rs2]);
+}
+
+static void exec_ecall(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    (void)insn;
+    if (minirisc->ecall != NULL)
+        ecall_dispatch(minirisc->ecall);
+    else
         set_reg(minirisc, 10, -1);
-        break;
-    }
-    case EBREAK_CODE:
+}
+
+static void exec_ebreak(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    (void)insn;
+    minirisc->halt = 1;
+    minirisc->exited = 1;
+    minirisc->exit_code = minirisc->regs[10];
+}
+
+static void exec_mul(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, minirisc->regs[insn->rs1] * minirisc->regs[insn->rs2]);
+}
+
+static void exec_mulh(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, ((int64_t)minirisc->regs[insn->rs1] * (int64_t)minirisc->regs[insn->rs2]) >> 32);
+}
+
+static void exec_mulhu(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, ((uint64_t)minirisc->regs[insn->rs1] * (uint64_t)minirisc->regs[insn->rs2]) >> 32);
+}
+
+static void exec_mulhsu(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    set_reg(minirisc, insn->rd, (((int64_t)minirisc->regs[insn->rs1] * (uint64_t)minirisc->regs[insn->rs2]) >> 32));
+}
+
+static void exec_div(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t a = minirisc->regs[insn->rs1];
+    uint32_t b = minirisc->regs[insn->rs2];
+
+    if (b == 0)
+        set_reg(minirisc, insn->rd, -1);
+    else if (a == -INT_MAX && b == (uint32_t)-1)
+        set_reg(minirisc, insn->rd, -INT_MAX);
+    else
+        set_reg(minirisc, insn->rd, a / b);
+}
+
+static void exec_rem(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t a = minirisc->regs[insn->rs1];
+    uint32_t b = minirisc->regs[insn->rs2];
+
+    if (b == 0)
+        set_reg(minirisc, insn->rd, a);
+    else if (a == -INT_MAX && b == (uint32_t)-1)
+        set_reg(minirisc, insn->rd, 0);
+    else
+        set_reg(minirisc, insn->rd, a - b * ((int32_t)a / (int32_t)b));
+}
+
+static void exec_divu(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t a = minirisc->regs[insn->rs1];
+    uint32_t b = minirisc->regs[insn->rs2];
+
+    if (b == 0)
+        set_reg(minirisc, insn->rd, 2 * INT_MAX - 1);
+    else
+        set_reg(minirisc, insn->rd, (int32_t)(a / b));
+}
+
+static void exec_remu(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t a = minirisc->regs[insn->rs1];
+    uint32_t b = minirisc->regs[insn->rs2];
+
+    if (b == 0)
+        set_reg(minirisc, insn->rd, a);
+    else
+        set_reg(minirisc, insn->rd, a - b * (int32_t)((int32_t)a / (int32_t)b));
+}
+
+/* 64 / 32 division: the dividend is rs2:rs1, the remainder goes to rd2, written last */
+
+static void exec_divl(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t low = minirisc->regs[insn->rs1];
+    int64_t a = (int64_t)((uint64_t)minirisc->regs[insn->rs2] << 32 | low);
+    int32_t b = minirisc->regs[insn->rs3];
+
+    if (b == 0)
     {
-        minirisc->halt = 1;
-        break;
+        set_reg(minirisc, insn->rd, -1);
+        set_reg(minirisc, insn->rd2, low);
     }
-    case MUL_CODE:
+    else if (a == INT64_MIN && b == -1)
     {
-        uint32_t value = minirisc->regs[rs1] * minirisc->regs[rs2];
-        set_reg(minirisc, rd, value);
-        break;
+        set_reg(minirisc, insn->rd, 0);
+        set_reg(minirisc, insn->rd2, 0);
     }
-    case MULH_CODE:
+    else
     {
-        uint32_t value = ((int64_t)minirisc->regs[rs1] * (int64_t)minirisc->regs[rs2]) >> 32;
-        set_reg(minirisc, rd, value);
-        break;
+        set_reg(minirisc, insn->rd, (uint32_t)(a / b));
+        set_reg(minirisc, insn->rd2, (uint32_t)(a % b));
     }
-    case MULHU_CODE:
+}
+
+static void exec_divlu(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    uint32_t low = minirisc->regs[insn->rs1];
+    uint64_t a = (uint64_t)minirisc->regs[insn->rs2] << 32 | low;
+    uint32_t b = minirisc->regs[insn->rs3];
+
+    if (b == 0)
     {
-        uint32_t value = ((uint64_t)minirisc->regs[rs1] * (uint64_t)minirisc->regs[rs2]) >> 32;
-        set_reg(minirisc, rd, value);
-        break;
+        set_reg(minirisc, insn->rd, -1);
+        set_reg(minirisc, insn->rd2, low);
     }
-    case MULHSU_CODE:
+    else
     {
-        uint32_t value = (((int64_t)minirisc->regs[rs1] * (uint64_t)minirisc->regs[rs2]) >> 32);
-        set_reg(minirisc, rd, value);
-        break;
+        set_reg(minirisc, insn->rd, (uint32_t)(a / b));
+        set_reg(minirisc, insn->rd2, (uint32_t)(a % b));
     }
-    case DIV_CODE:
-    {
-        if (minirisc->regs[rs2] == 0)
-        {
-            uint32_t value = -1;
-            set_reg(minirisc, rd, value);
-        }
-        else if (minirisc->regs[rs1] == -INT_MAX && minirisc->regs[rs2] == (uint32_t)-1)
-        {
-            uint32_t value = -INT_MAX;
-            set_reg(minirisc, rd, value);
-        }
-        else
-        {
-            uint32_t value = minirisc->regs[rs1] / minirisc->regs[rs2];
-            set_reg(minirisc, rd, value);
-        }
+}
+
+static void exec_unknown(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    struct iothread_t *io = minirisc->platform->io;
+    uint32_t instr = insn->raw;
+
+    iothread_printf(io, "\n========================================\n");
+    iothread_printf(io, "Unknown opcode   : 0x%02x (%d)\n", insn->opcode, insn->opcode);
+    iothread_printf(io, "Full instruction : 0x%08x\n", instr);
+    iothread_printf(io, "At PC            : 0x%08x\n", minirisc->PC);
+    iothread_printf(io, "rd=%d, rs1=%d, rs2=%d\n", insn->rd, insn->rs1, insn->rs2);
+    iothread_printf(io, "funct3=%d, funct7=%d\n", (instr >> 12) & 0x7, (instr >> 25) & 0x7F);
+    iothread_printf(io, "========================================\n");
+    minirisc->halt = 1;
+}
+
+static void exec_fetch_fault(struct minirisc_t *minirisc, struct insn_t *insn)
+{
+    (void)insn;
+    iothread_printf(minirisc->platform->io, "Instruction fetch fault at PC 0x%08x\n", minirisc->PC);
+    minirisc->halt = 1;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Decoder                                                                    */
+/* ------------------------------------------------------------------------- */
+
+/* Immediate formats */
+enum imm_format_t
+{
+    IMM_NONE = 0,
+    IMM_I,     /* imm[11:0] sign-extended */
+    IMM_B,     /* imm[11:0] << 1 sign-extended (branches) */
+    IMM_U,     /* imm[19:0] << 12 */
+    IMM_J,     /* imm[19:0] << 1 sign-extended (JAL) */
+    IMM_SHAMT, /* shift amount */
+};
+
+struct opcode_desc_t
+{
+    insn_exec_t exec;
+    enum imm_format_t format;
+};
+
+static const struct opcode_desc_t opcode_table[128] = {
+    [LUI_CODE] = {exec_lui, IMM_U},
+    [AUIPC_CODE] = {exec_auipc, IMM_U},
+    [JAL_CODE] = {exec_jal, IMM_J},
+    [JALR_CODE] = {exec_jalr, IMM_I},
+    [BEQ_CODE] = {exec_beq, IMM_B},
+    [BNE_CODE] = {exec_bne, IMM_B},
+    [BLT_CODE] = {exec_blt, IMM_B},
+    [BGE_CODE] = {exec_bge, IMM_B},
+    [BLTU_CODE] = {exec_bltu, IMM_B},
+    [BGEU_CODE] = {exec_bgeu, IMM_B},
+    [LB_CODE] = {exec_lb, IMM_I},
+    [LH_CODE] = {exec_lh, IMM_I},
+    [LW_CODE] = {exec_lw, IMM_I},
+    [LBU_CODE] = {exec_lbu, IMM_I},
+    [LHU_CODE] = {exec_lhu, IMM_I},
+    [SB_CODE] = {exec_sb, IMM_I},
+    [SH_CODE] = {exec_sh, IMM_I},
+    [SW_CODE] = {exec_sw, IMM_I},
+    [ADDI_CODE] = {exec_addi, IMM_I},
+    [SLTI_CODE] = {exec_slti, IMM_I},
+    [SLTIU_CODE] = {exec_sltiu, IMM_I},
+    [XORI_CODE] = {exec_xori, IMM_I},
+    [ORI_CODE] = {exec_ori, IMM_I},
+    [ANDI_CODE] = {exec_andi, IMM_I},
+    [SLLI_CODE] = {exec_slli, IMM_SHAMT},
+    [SRLI_CODE] = {exec_srli, IMM_SHAMT},
+    [SRAI_CODE] = {exec_srai, IMM_SHAMT},
+    [ADD_CODE] = {exec_add, IMM_NONE},
+    [SUB_CODE] = {exec_sub, IMM_NONE},
+    [SLL_CODE] = {exec_sll, IMM_NONE},
+    [SRL_CODE] = {exec_srl, IMM_NONE},
+    [SRA_CODE] = {exec_sra, IMM_NONE},
+    [SLT_CODE] = {exec_slt, IMM_NONE},
+    [SLTU_CODE] = {exec_sltu, IMM_NONE},
+    [XOR_CODE] = {exec_xor, IMM_NONE},
+    [OR_CODE] = {exec_or, IMM_NONE},
+    [AND_CODE] = {exec_and, IMM_NONE},
+    [ECALL_CODE] = {exec_ecall, IMM_NONE},
+    [EBREAK_CODE] = {exec_ebreak, IMM_NONE},
+    [MUL_CODE] = {exec_mul, IMM_NONE},
+    [MULH_CODE] = {exec_mulh, IMM_NONE},
+    [MULHSU_CODE] = {exec_mulhsu, IMM_NONE},
+    [MULHU_CODE] = {exec_mulhu, IMM_NONE},
+    [DIV_CODE] = {exec_div, IMM_NONE},
+    [DIVU_CODE] = {exec_divu, IMM_NONE},
+    [REM_CODE] = {exec_rem, IMM_NONE},
+    [REMU_CODE] = {exec_remu, IMM_NONE},
+    [DIVL_CODE] = {exec_divl, IMM_NONE},
+    [DIVLU_CODE] = {exec_divlu, IMM_NONE},
+};
+
+void minirisc_decode(uint32_t instr, struct insn_t *insn)
+{
+    uint32_t opcode = instr & 0x7F;
+    uint32_t imm = (instr >> 20) & 0xFFF;
+    uint32_t imm_lui = (instr >> 12) & 0xFFFFF;
+    const struct opcode_desc_t *desc = &opcode_table[opcode];
+
+    insn->raw = instr;
+    insn->opcode = opcode;
+    insn->rd = (instr >> 7) & 0x1F;
+    insn->rs1 = (instr >> 12) & 0x1F;
+    insn->rs2 = (instr >> 17) & 0x1F;
+    insn->rs3 = (instr >> 22) & 0x1F;
+    insn->rd2 = (instr >> 27) & 0x1F;
+    if (fpu_decode(instr, insn))
+        return;
+    insn->exec = desc->exec ? desc->exec : exec_unknown;
+
+    switch (desc->format)
+    {
+    case IMM_I:
+        extend_sign(&imm, 11);
+        insn->imm = imm;
         break;
-    }
-    case REM_CODE:
-    {
-        if (minirisc->regs[rs2] == 0)
-        {
-            uint32_t value = minirisc->regs[rs1];
-            set_reg(minirisc, rd, value);
-        }
-        else if (minirisc->regs[rs1] == -INT_MAX && minirisc->regs[rs2] == (uint32_t)-1)
-        {
-            uint32_t value = 0;
-            set_reg(minirisc, rd, value);
-        }
-        else
-        {
-            uint32_t value = minirisc->regs[rs1] - minirisc->regs[rs2] * ((int32_t)minirisc->regs[rs1] / (int32_t)minirisc->regs[rs2]);
-            set_reg(minirisc, rd, value);
-        }
+    case IMM_B:
+        imm <<= 1;
+        extend_sign(&imm, 12);
+        insn->imm = imm;
         break;
-    }
-    case DIVU_CODE:
-    {
-        if (minirisc->regs[rs2] == 0)
-        {
-            uint32_t value = 2 * INT_MAX - 1;
-            set_reg(minirisc, rd, value);
-        }
-        else
-        {
-            uint32_t value = (int32_t)(minirisc->regs[rs1] / minirisc->regs[rs2]);
-            set_reg(minirisc, rd, value);
-        }
+    case IMM_U:
+        insn->imm = imm_lui << 12;
         break;
-    }
-    case REMU_CODE:
-    {
-        if (minirisc->regs[rs2] == 0)
-        {
-            uint32_t value = minirisc->regs[rs1];
-            set_reg(minirisc, rd, value);
-        }
-        else
-        {
-            uint32_t value = minirisc->regs[rs1] - minirisc->regs[rs2] * (int32_t)((int32_t)minirisc->regs[rs1] / (int32_t)minirisc->regs[rs2]);
-            set_reg(minirisc, rd, value);
-        }
+    case IMM_J:
+        imm_lui <<= 1;
+        extend_sign(&imm_lui, 20);
+        insn->imm = imm_lui;
+        break;
+    case IMM_SHAMT:
+        insn->imm = (instr >> 20) & 0x1F;
         break;
-    }
     default:
-    {
-        printf("\n========================================\n");
-        printf("Unknown opcode   : 0x%02x (%d)\n", opcode, opcode);
-        printf("Full instruction : 0x%08x\n", instr);
-        printf("At PC            : 0x%08x\n", minirisc->PC);
-        printf("rd=%d, rs1=%d, rs2=%d\n", rd, rs1, rs2);
-        printf("funct3=%d, funct7=%d\n", (instr >> 12) & 0x7, (instr >> 25) & 0x7F);
-        printf("========================================\n");
-        fflush(stdout);
-        minirisc->halt = 1;
+        insn->imm = 0;
         break;
     }
-    }
+}
+
+void minirisc_decode_at(struct minirisc_t *minirisc, uint32_t pc, uint32_t instr, struct insn_t *insn)
+{
+    minirisc_decode(instr, insn);
+    if (minirisc->hle)
+        hle_decode(minirisc->hle, pc, insn);
+}
+
+void minirisc_decode_fetch_fault(struct insn_t *insn)
+{
+    /* Decoded as EBREAK, so that every engine ends the block there and runs the handler */
+    minirisc_decode(EBREAK_CODE, insn);
+    insn->exec = exec_fetch_fault;
+}
+
+void minirisc_decode_and_execute(struct minirisc_t *minirisc)
+{
+    struct insn_t insn;
+
+    minirisc_decode(minirisc->IR, &insn);
+    minirisc->next_PC = minirisc->PC + 4;
+    insn.exec(minirisc, &insn);
 }
 
 void extend_sign(uint32_t *imm, int n)
@@ -528,12 +706,57 @@ void set_reg(struct minirisc_t *minirisc, int reg, uint32_t value)
     minirisc->regs[reg] = value & ((reg == 0) - 1); /* We force the reg[0] to 0 during the writing */
 }
 
+void minirisc_step(struct minirisc_t *minirisc)
+{
+    struct insn_t *insn = icache_lookup(minirisc->icache, minirisc->PC);
+
+    if (minirisc->profile)
+        profile_add(minirisc->profile, minirisc->PC, 1);
+    if (minirisc->trace)
+        trace_insn(minirisc->trace, minirisc->PC);
+    minirisc->next_PC = minirisc->PC + 4;
+    insn->exec(minirisc, insn);
+    minirisc->PC = minirisc->next_PC;
+    minirisc->instret++;
+}
+
+static void minirisc_run_interp(struct minirisc_t *minirisc)
+{
+    struct icache_t *icache = minirisc->icache;
+    struct profile_t *profile = minirisc->profile;
+    struct trace_t *trace = minirisc->trace;
+    struct insn_t *insn;
+
+    while (!minirisc->halt && minirisc->instret < minirisc->max_instret)
+    {
+        if (profile)
+            profile_add(profile, minirisc->PC, 1);
+        if (trace)
+            trace_insn(trace, minirisc->PC);
+        insn = icache_lookup(icache, minirisc->PC);
+        minirisc->next_PC = minirisc->PC + 4;
+        insn->exec(minirisc, insn);
+        minirisc->PC = minirisc->next_PC;
+        minirisc->instret++;
+    }
+}
+
 void minirisc_run(struct minirisc_t *minirisc)
 {
-    while (!minirisc->halt)
+    switch (minirisc->engine)
     {
-        minirisc_fetch(minirisc);
-        minirisc_decode_and_execute(minirisc);
-        minirisc->PC = minirisc->next_PC;
+    case ENGINE_SWITCH:
+        threaded_run_switch(minirisc);
+        break;
+    case ENGINE_THREADED:
+        threaded_run(minirisc);
+        break;
+    case ENGINE_BLOCK:
+    case ENGINE_JIT:
+        block_run(minirisc);
+        break;
+    default:
+        minirisc_run_interp(minirisc);
+        break;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "types.h"
+#include "platform.h"
+#include "minirisc.h"
+#include "mtimer.h"
+
+#define MTIMER_PACE_SLACK_US 1000 /* Lead over real time tolerated by the paced clock */
+
+static uint64_t host_elapsed_us(const struct mtimer_t *mtimer)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - mtimer->start.tv_sec) * 1000000ull + (now.tv_nsec - mtimer->start.tv_nsec) / 1000;
+}
+
+static void sleep_us(uint64_t us)
+{
+    struct timespec delay = {us / 1000000, (us % 1000000) * 1000};
+
+    nanosleep(&delay, NULL);
+}
+
+static uint64_t virtual_us(const struct mtimer_t *mtimer)
+{
+    uint64_t instret = mtimer->minirisc->instret;
+
+    /* Split to avoid overflowing instret * 1000000 */
+    return instret / mtimer->freq * 1000000 + instret % mtimer->freq * 1000000 / mtimer->freq + mtimer->slept;
+}
+
+uint64_t mtimer_now(struct mtimer_t *mtimer)
+{
+    uint64_t now, host;
+
+    switch (mtimer->mode)
+    {
+    case MTIMER_HOST:
+        return mtimer->origin + host_elapsed_us(mtimer);
+    case MTIMER_PACED:
+        now = virtual_us(mtimer);
+        host = mtimer->origin + host_elapsed_us(mtimer);
+        if (now > host + MTIMER_PACE_SLACK_US)
+            sleep_us(now - host);
+        return now;
+    case MTIMER_VIRTUAL:
+    default:
+        return virtual_us(mtimer);
+    }
+}
+
+static int mtimer_read(void *opaque, uint32_t offset, enum access_type_t access_type, uint32_t *data)
+{
+    struct mtimer_t *mtimer = opaque;
+    uint64_t now;
+
+    if (access_type != ACCESS_WORD)
+        return -1;
+
+    switch (offset)
+    {
+    case MTIMER_TIME:
+        now = mtimer_now(mtimer);
+        mtimer->latched_hi = now >> 32;
+        *data = (uint32_t)now;
+        break;
+    case MTIMER_TIME_HI:
+        *data = mtimer->latched_hi;
+        break;
+    case MTIMER_FREQ:
+        *data = 1000000;
+        break;
+    case MTIMER_SLEEP:
+        *data = 0;
+        break;
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+static int mtimer_write(void *opaque, uint32_t offset, enum access_type_t access_type, uint32_t data)
+{
+    struct mtimer_t *mtimer = opaque;
+
+    if (access_type != ACCESS_WORD || offset != MTIMER_SLEEP)
+        return -1;
+
+    if (mtimer->mode == MTIMER_HOST)
+        sleep_us(data);
+    else
+    {
+        /* The virtual clock jumps ahead; the paced one then waits for real time to catch up */
+        mtimer->slept += data;
+        if (mtimer->mode == MTIMER_PACED)
+            mtimer_now(mtimer);
+    }
+
+    return 0;
+}
+
+int mtimer_parse_mode(const char *name, enum mtimer_mode_t *mode)
+{
+    if (strcmp(name, "virtual") == 0)
+        *mode = MTIMER_VIRTUAL;
+    else if (strcmp(name, "host") == 0)
+        *mode = MTIMER_HOST;
+    else if (strcmp(name, "paced") == 0)
+        *mode = MTIMER_PACED;
+    else
+        return -1;
+
+    return 0;
+}
+
+struct mtimer_t *mtimer_new(struct minirisc_t *minirisc, enum mtimer_mode_t mode, uint64_t freq)
+{
+    struct mtimer_t *mtimer;
+
+    if ((mtimer = calloc(1, sizeof(struct mtimer_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    mtimer->minirisc = minirisc;
+    mtimer->mode = mode;
+    mtimer->freq = freq;
+    mtimer_start(mtimer);
+    platform_add_device(minirisc->platform, "mtimer", MTIMER_BASE, MTIMER_SIZE, mtimer_read, mtimer_write, mtimer);
+
+    return mtimer;
+}
+
+void mtimer_start(struct mtimer_t *mtimer)
+{
+    mtimer->origin = virtual_us(mtimer);
+    clock_gettime(CLOCK_MONOTONIC, &mtimer->start);
+}
+
+void mtimer_free(struct mtimer_t *mtimer)
+{
+    free(mtimer);
+}
@@ -1,35 +1,277 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/mman.h>
 
 #include "types.h"
 #include "platform.h"
+#include "framebuffer.h"
+#include "iothread.h"
+#include "dma.h"
 
-struct platform_t *platform_new()
+static int charout_read(void *opaque, uint32_t offset, enum access_type_t access_type, uint32_t *data)
+{
+    struct platform_t *plt = opaque;
+    (void)access_type;
+
+    switch (offset)
+    {
+    case CHAROUT_CHAR:
+    case CHAROUT_INT:
+    case CHAROUT_HEX:
+    case CHAROUT_BUF_LEN:
+        *data = 0x0;
+        break;
+    case CHAROUT_BUF_ADDR:
+        *data = plt->charout_buffer;
+        break;
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+static int charout_write(void *opaque, uint32_t offset, enum access_type_t access_type, uint32_t data)
+{
+    struct platform_t *plt = opaque;
+    const void *buffer;
+    char c;
+    (void)access_type;
+
+    switch (offset)
+    {
+    case CHAROUT_CHAR:
+        c = data;
+        iothread_write(plt->io, &c, 1);
+        break;
+    case CHAROUT_INT:
+        iothread_printf(plt->io, "%d", (int32_t)data);
+        break;
+    case CHAROUT_HEX:
+        iothread_printf(plt->io, "0x%08x", data);
+        break;
+    case CHAROUT_BUF_ADDR:
+        plt->charout_buffer = data;
+        break;
+    case CHAROUT_BUF_LEN:
+        if ((buffer = platform_host_range(plt, plt->charout_buffer, data, 0)) == NULL)
+        {
+            iothread_printf(plt->io, "[ERROR] Console buffer %08x (%u bytes) is not in RAM\n", plt->charout_buffer,
+                            data);
+            return -1;
+        }
+        iothread_write(plt->io, buffer, data);
+        break;
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+struct platform_t *platform_new(uint32_t ram_size)
 {
     struct platform_t *plt;
 
-    if ((plt = malloc(sizeof(struct platform_t))) == NULL)
+    if (ram_size == 0 || (ram_size & PAGE_MASK) || ram_size > PLATFORM_MAX_RAM_SIZE)
     {
-        printf("Malloc error.\n");
+        printf("Invalid RAM size: %u bytes.\n", ram_size);
         exit(EXIT_FAILURE);
     }
 
-    plt->size = 64 * 1024 * 1024;
-    if ((plt->memory = malloc(plt->size * sizeof(uint8_t))) == NULL)
+    if ((plt = calloc(1, sizeof(struct platform_t))) == NULL)
     {
         printf("Malloc error.\n");
         exit(EXIT_FAILURE);
     }
 
+    /* Pages are only backed once written, and the ELF loader can map segments over them */
+    plt->size = ram_size;
+    if ((plt->memory = mmap(NULL, plt->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)) == MAP_FAILED)
+    {
+        printf("Mmap error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    plt->devices = NULL;
+    plt->code_write = NULL;
+    plt->code_write_opaque = NULL;
+    platform_tlb_flush(plt);
+
+    plt->io = iothread_new();
+    platform_map_memory(plt, RAM_BASE, plt->size, plt->memory, PAGE_READ | PAGE_WRITE);
+    platform_add_device(plt, "charout", CHAROUT_BASE, CHAROUT_SIZE, charout_read, charout_write, plt);
+    plt->framebuffer = framebuffer_new(plt);
+    plt->dma = dma_new(plt);
+
     return plt;
 }
 
 void platform_free(struct platform_t *platform)
 {
-    free(platform->memory);
+    struct device_t *device, *next;
+    int i;
+
+    framebuffer_free(platform->framebuffer);
+    dma_free(platform->dma);
+    for (device = platform->devices; device != NULL; device = next)
+    {
+        next = device->next;
+        free(device);
+    }
+    for (i = 0; i < (1 << L1_BITS); i++)
+        free(platform->pages[i]);
+    munmap(platform->memory, platform->size);
+    iothread_free(platform->io);
     free(platform);
 }
 
+struct page_t *platform_page(struct platform_t *platform, uint32_t addr)
+{
+    struct page_t *l2 = platform->pages[addr >> (PAGE_SHIFT + L2_BITS)];
+    struct page_t *page;
+
+    if (l2 == NULL)
+        return NULL;
+
+    page = &l2[(addr >> PAGE_SHIFT) & (L2_SIZE - 1)];
+    if (page->host == NULL && page->device == NULL)
+        return NULL;
+
+    return page;
+}
+
+/**
+ * Return the page holding addr, allocating its second level table if needed.
+ */
+static struct page_t *platform_page_alloc(struct platform_t *platform, uint32_t addr)
+{
+    struct page_t **l2 = &platform->pages[addr >> (PAGE_SHIFT + L2_BITS)];
+
+    if (*l2 == NULL && (*l2 = calloc(L2_SIZE, sizeof(struct page_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return &(*l2)[(addr >> PAGE_SHIFT) & (L2_SIZE - 1)];
+}
+
+void platform_map_memory(struct platform_t *platform, uint32_t base, uint32_t size, void *host, uint32_t flags)
+{
+    struct page_t *page;
+    uint32_t offset;
+
+    for (offset = 0; offset < size; offset += PAGE_SIZE)
+    {
+        page = platform_page_alloc(platform, base + offset);
+        page->host = (uint8_t *)host + offset;
+        page->device = NULL;
+        page->flags = flags;
+    }
+    platform_tlb_flush(platform);
+}
+
+struct device_t *platform_add_device(struct platform_t *platform, const char *name, uint32_t base, uint32_t size,
+                                     int (*read)(void *opaque, uint32_t offset, enum access_type_t access_type, uint32_t *data),
+                                     int (*write)(void *opaque, uint32_t offset, enum access_type_t access_type, uint32_t data),
+                                     void *opaque)
+{
+    struct device_t *device;
+    struct page_t *page;
+    uint32_t offset;
+
+    if ((device = malloc(sizeof(struct device_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    device->name = name;
+    device->base = base;
+    device->size = size;
+    device->read = read;
+    device->write = write;
+    device->opaque = opaque;
+    device->next = platform->devices;
+    platform->devices = device;
+
+    for (offset = 0; offset < size; offset += PAGE_SIZE)
+    {
+        page = platform_page_alloc(platform, base + offset);
+        page->host = NULL;
+        page->device = device;
+        page->flags = PAGE_READ | PAGE_WRITE;
+    }
+    platform_tlb_flush(platform);
+
+    return device;
+}
+
+void platform_tlb_flush(struct platform_t *platform)
+{
+    int i;
+
+    for (i = 0; i < TLB_SIZE; i++)
+    {
+        platform->tlb_read[i].page = TLB_INVALID;
+        platform->tlb_write[i].page = TLB_INVALID;
+    }
+}
+
+void platform_set_code_write_hook(struct platform_t *platform, void (*hook)(void *opaque, uint32_t addr, uint32_t len), void *opaque)
+{
+    platform->code_write = hook;
+    platform->code_write_opaque = opaque;
+}
+
+void platform_mark_code(struct platform_t *platform, uint32_t addr)
+{
+    struct page_t *page = platform_page(platform, addr);
+    struct tlb_entry_t *entry = &platform->tlb_write[(addr >> PAGE_SHIFT) & (TLB_SIZE - 1)];
+
+    if (page == NULL || page->host == NULL)
+        return;
+
+    page->flags |= PAGE_CODE;
+    if (entry->page == (addr & ~PAGE_MASK))
+        entry->page = TLB_INVALID;
+}
+
+void *platform_host_range(struct platform_t *platform, uint32_t addr, uint32_t len, int write)
+{
+    uint32_t offset = addr - RAM_BASE;
+    uint32_t n_pages = ((addr & PAGE_MASK) + (uint64_t)len + PAGE_MASK) >> PAGE_SHIFT;
+    uint32_t first = addr & ~PAGE_MASK;
+    uint32_t i, start, size;
+    struct page_t *page;
+
+    if (offset >= platform->size || len > platform->size - offset)
+        return NULL;
+    if (!write)
+        return (uint8_t *)platform->memory + offset;
+
+    for (i = 0; i < n_pages; i++)
+    {
+        page = platform_page(platform, first + (i << PAGE_SHIFT));
+        if (page == NULL || !(page->flags & PAGE_WRITE))
+            return NULL;
+    }
+
+    /* The caller writes the whole range: drop the decodings it overwrites */
+    for (i = 0; i < n_pages; i++)
+    {
+        page = platform_page(platform, first + (i << PAGE_SHIFT));
+        if ((page->flags & PAGE_CODE) && platform->code_write)
+        {
+            start = i == 0 ? addr : first + (i << PAGE_SHIFT);
+            size = i == n_pages - 1 ? addr + len - start : PAGE_SIZE - (start & PAGE_MASK);
+            platform->code_write(platform->code_write_opaque, start, size);
+        }
+    }
+
+    return (uint8_t *)platform->memory + offset;
+}
+
 void platform_load_program(struct platform_t *platform, const char *file_name)
 {
     FILE *fp = fopen(file_name, "rb");
@@ -46,136 +288,137 @@ void platform_load_program(struct platform_t *platform, const char *file_name)
     fclose(fp);
 }
 
-int platform_read(struct platform_t *platform, enum access_type_t access_type, uint32_t addr, uint32_t *data)
+/**
+ * Load a TLB entry for the page of addr.
+ */
+static void tlb_fill(struct tlb_entry_t *tlb, struct page_t *page, uint32_t addr)
 {
-    if (addr == CHAROUT_BASE || addr == CHAROUT_BASE + 4 || addr == CHAROUT_BASE + 8)
-    {
-        *data = 0x0;
-        return 0;
-    }
+    struct tlb_entry_t *entry = &tlb[(addr >> PAGE_SHIFT) & (TLB_SIZE - 1)];
 
-    /* Add: condition RAM */
-    if ((addr < RAM_BASE) || (addr >= (RAM_BASE + platform->size)))
+    entry->page = addr & ~PAGE_MASK;
+    entry->addend = (uintptr_t)page->host - entry->page;
+}
+
+__attribute__((cold, noinline)) int platform_read_slow(struct platform_t *platform, enum access_type_t access_type, uint32_t addr, uint32_t *data)
+{
+    struct page_t *page = platform_page(platform, addr);
+    uint8_t *p;
+
+    if (page == NULL || (page->device && page->device->read(page->device->opaque, addr - page->device->base, access_type, data) == -1))
     {
-        printf("\n[ERROR] Invalid read at address %08x\n", addr);
-        printf("Access type: %s\n",
-               access_type == ACCESS_BYTE ? "BYTE" : access_type == ACCESS_HALF ? "HALF"
-                                                                                : "WORD");
-        printf("Valid range: %08x - %08x\n", RAM_BASE, RAM_BASE + platform->size - 1);
+        iothread_printf(platform->io, "\n[ERROR] Invalid read at address %08x\n", addr);
+        iothread_printf(platform->io, "Access type: %s\n",
+                        access_type == ACCESS_BYTE ? "BYTE" : access_type == ACCESS_HALF ? "HALF"
+                                                                                         : "WORD");
+        iothread_printf(platform->io, "Valid range: %08x - %08x\n", RAM_BASE, RAM_BASE + platform->size - 1);
 
         // Si c'est un accès word, vérifier si ça déborde
         if (access_type == ACCESS_WORD && addr >= RAM_BASE + platform->size - 3)
         {
-            printf("Word access at boundary! Addr=%08x would read until %08x\n",
-                   addr, addr + 3);
+            iothread_printf(platform->io, "Word access at boundary! Addr=%08x would read until %08x\n",
+                            addr, addr + 3);
         }
 
-        printf("Segmentation Fault\n");
+        iothread_printf(platform->io, "Segmentation Fault\n");
         exit(1);
     }
 
-    uint32_t offset = addr - RAM_BASE;
-
-    switch (access_type)
+    if (page->device)
     {
-    case ACCESS_BYTE:
-    {
-        uint8_t *p = (uint8_t *)platform->memory;
-        *data = p[offset];
+        STATS_INC(platform->mmio_accesses);
+        return 0;
     }
-    break;
 
-    case ACCESS_HALF:
+    /* Alignement check */
+    if (addr & ((1 << access_type) - 1))
     {
-        /* Alignement check */
-        if (addr & 0x1)
-        {
-            printf("Load half address misaligned exception.\n");
-            return -1;
-        }
-        uint16_t *p = (uint16_t *)platform->memory;
-        *data = p[offset >> 1];
+        iothread_printf(platform->io, "Load %s address misaligned exception.\n", access_type == ACCESS_HALF ? "half" : "word");
+        return -1;
     }
-    break;
 
+    tlb_fill(platform->tlb_read, page, addr);
+    p = page->host + (addr & PAGE_MASK);
+
+    switch (access_type)
+    {
+    case ACCESS_BYTE:
+        *data = *p;
+        break;
+    case ACCESS_HALF:
+        *data = *(uint16_t *)p;
+        break;
     case ACCESS_WORD:
-        /* Alignement check */
-        if (addr & 0x3)
-        {
-            printf("Load word address misaligned exception.\n");
-            return -1;
-        }
-        *data = platform->memory[offset >> 2];
+        *data = *(uint32_t *)p;
         break;
-
     default:
-        printf("Error reading access.\n");
+        iothread_printf(platform->io, "Error reading access.\n");
         return -1;
-        break;
     }
 
     return 0;
 }
 
-int platform_write(struct platform_t *platform, enum access_type_t access_type, uint32_t addr, uint32_t data)
+__attribute__((cold, noinline)) int platform_write_slow(struct platform_t *platform, enum access_type_t access_type, uint32_t addr, uint32_t data)
 {
-    /* RAM */
-    if ((addr >= RAM_BASE) && (addr < (RAM_BASE + platform->size)))
+    struct page_t *page = platform_page(platform, addr);
+    uint8_t *p;
+
+    if (page == NULL)
     {
-        switch (access_type)
-        {
-        case ACCESS_BYTE:
-        {
-            uint8_t *p = (uint8_t *)platform->memory;
-            p[(addr - RAM_BASE)] = data;
-            break;
-        }
-        case ACCESS_HALF:
-        {
-            /* Alignement check */
-            if (addr & 0x1)
-            {
-                printf("Write half address misaligned exception.\n");
-                exit(1);
-            }
-            uint16_t *p = (uint16_t *)platform->memory;
-            p[(addr - RAM_BASE) >> 1] = data;
-            break;
-        }
-        case ACCESS_WORD:
+        iothread_printf(platform->io, "Segmentation Fault.\n");
+        exit(1);
+    }
+
+    if (page->device)
+    {
+        STATS_INC(platform->mmio_accesses);
+        if (page->device->write(page->device->opaque, addr - page->device->base, access_type, data) == -1)
         {
-            /* Alignement check */
-            if (addr & 0x3)
-            {
-                printf("Write word address misaligned exception.\n");
-                exit(1);
-            }
-            platform->memory[(addr - RAM_BASE) >> 2] = data;
-            break;
-        }
-        default:
-            printf("Error reading access.\n");
+            iothread_printf(platform->io, "Segmentation Fault.\n");
             exit(1);
-            break;
         }
+        return 0;
     }
-    else if (addr == CHAROUT_BASE)
+
+    if (!(page->flags & PAGE_WRITE))
     {
-        printf("%c", (char)data);
+        iothread_printf(platform->io, "Write to read-only memory at %08x.\n", addr);
+        return -1;
     }
-    else if (addr == CHAROUT_BASE + 4)
+
+    /* Alignement check */
+    if (addr & ((1 << access_type) - 1))
     {
-        printf("%d", (int32_t)data);
+        iothread_printf(platform->io, "Write %s address misaligned exception.\n", access_type == ACCESS_HALF ? "half" : "word");
+        exit(1);
     }
-    else if (addr == CHAROUT_BASE + 8)
+
+    /* Stores to pages holding decoded code must drop the stale decodings */
+    if (page->flags & PAGE_CODE)
     {
-        printf("0x%08x", data);
+        if (platform->code_write)
+            platform->code_write(platform->code_write_opaque, addr, 1 << access_type);
     }
     else
+        tlb_fill(platform->tlb_write, page, addr);
+
+    p = page->host + (addr & PAGE_MASK);
+
+    switch (access_type)
     {
-        printf("Segmentation Fault.\n");
+    case ACCESS_BYTE:
+        *p = data;
+        break;
+    case ACCESS_HALF:
+        *(uint16_t *)p = data;
+        break;
+    case ACCESS_WORD:
+        *(uint32_t *)p = data;
+        break;
+    default:
+        iothread_printf(platform->io, "Error reading access.\n");
         exit(1);
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+#include "types.h"
+#include "elf_loader.h"
+#include "profile.h"
+
+struct profile_t *profile_new(uint32_t ram_size)
+{
+    struct profile_t *profile;
+
+    if ((profile = malloc(sizeof(struct profile_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    profile->n_words = ram_size >> 2;
+    profile->counts = mmap(NULL, (size_t)profile->n_words * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (profile->counts == MAP_FAILED)
+    {
+        printf("Mmap error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return profile;
+}
+
+void profile_free(struct profile_t *profile)
+{
+    munmap(profile->counts, (size_t)profile->n_words * sizeof(uint64_t));
+    free(profile);
+}
+
+struct profile_entry_t
+{
+    uint64_t count;
+    uint32_t index; /* Symbol index or instruction word */
+};
+
+static int entry_cmp(const void *a, const void *b)
+{
+    const struct profile_entry_t *ea = a, *eb = b;
+
+    return (ea->count < eb->count) - (ea->count > eb->count);
+}
+
+static const struct elf_symbol_t *profile_symbol(struct elf_t *elf, uint32_t pc)
+{
+    return elf != NULL ? elf_symbol_at(elf, pc) : NULL;
+}
+
+int profile_write_report(struct profile_t *profile, struct elf_t *elf, const char *file_name)
+{
+    uint32_t n_symbols = elf != NULL ? elf->n_symbols : 0;
+    struct profile_entry_t *functions;
+    struct profile_entry_t top[PROFILE_TOP_PCS];
+    const struct elf_symbol_t *sym;
+    uint32_t n_top = 0;
+    uint64_t total = 0;
+    uint32_t word, pc, i, j;
+    FILE *fp;
+
+    if ((fp = fopen(file_name, "w")) == NULL)
+    {
+        perror("Error while opening the profile file");
+        return -1;
+    }
+
+    /* One entry per symbol, the last one collects code outside any symbol */
+    if ((functions = calloc(n_symbols + 1, sizeof(struct profile_entry_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i <= n_symbols; i++)
+        functions[i].index = i;
+
+    for (word = 0; word < profile->n_words; word++)
+    {
+        if (profile->counts[word] == 0)
+            continue;
+        pc = RAM_BASE + 4 * word;
+        total += profile->counts[word];
+
+        sym = profile_symbol(elf, pc);
+        functions[sym != NULL ? (uint32_t)(sym - elf->symbols) : n_symbols].count += profile->counts[word];
+
+        /* Keep the hottest instructions, sorted */
+        for (i = n_top; i > 0 && top[i - 1].count < profile->counts[word]; i--)
+        {
+            if (i < PROFILE_TOP_PCS)
+                top[i] = top[i - 1];
+        }
+        if (i < PROFILE_TOP_PCS)
+        {
+            top[i].count = profile->counts[word];
+            top[i].index = word;
+            if (n_top < PROFILE_TOP_PCS)
+                n_top++;
+        }
+    }
+    qsort(functions, n_symbols + 1, sizeof(struct profile_entry_t), entry_cmp);
+
+    fprintf(fp, "# Profile: %" PRIu64 " instructions\n\n", total);
+    fprintf(fp, "# Functions\n");
+    fprintf(fp, "%16s %7s  %s\n", "instructions", "%", "function");
+    for (i = 0; i <= n_symbols && functions[i].count != 0; i++)
+    {
+        j = functions[i].index;
+        fprintf(fp, "%16" PRIu64 " %7.2f  %s\n", functions[i].count, 100.0 * functions[i].count / total,
+                j < n_symbols ? elf->symbols[j].name : "??");
+    }
+
+    fprintf(fp, "\n# Hottest instructions\n");
+    fprintf(fp, "%-10s %16s %7s  %s\n", "pc", "instructions", "%", "location");
+    for (i = 0; i < n_top; i++)
+    {
+        pc = RAM_BASE + 4 * top[i].index;
+        sym = profile_symbol(elf, pc);
+        fprintf(fp, "%08x   %16" PRIu64 " %7.2f  ", pc, top[i].count, 100.0 * top[i].count / total);
+        if (sym != NULL)
+            fprintf(fp, "%s+0x%x\n", sym->name, pc - sym->addr);
+        else
+            fprintf(fp, "??\n");
+    }
+
+    free(functions);
+
+    return fclose(fp) == 0 ? 0 : -1;
+}
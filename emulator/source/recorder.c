@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "platform.h"
+#include "recorder.h"
+#include "iothread.h"
+
+int recorder_parse_format(const char *name, enum recorder_format_t *format)
+{
+    if (strcmp(name, "y4m") == 0)
+        *format = RECORDER_Y4M;
+    else if (strcmp(name, "ppm") == 0)
+        *format = RECORDER_PPM;
+    else if (strcmp(name, "rgba") == 0)
+        *format = RECORDER_RGBA;
+    else
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Framebuffer listener, on the emulation thread.
+ */
+static void recorder_capture(void *opaque, const struct framebuffer_t *fb, const uint32_t *pixels)
+{
+    struct recorder_t *recorder = opaque;
+    uint64_t number = fb->frames - 1;
+    size_t n_pixels = (size_t)fb->width * fb->height;
+    struct recorder_frame_t *frame;
+    uint32_t tail;
+
+    if (number % recorder->every != 0)
+        return;
+
+    tail = atomic_load_explicit(&recorder->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&recorder->head, memory_order_acquire) == RECORDER_SLOTS)
+    {
+        recorder->dropped++;
+        return;
+    }
+
+    /* Slots outside [head, tail) belong to this thread, their buffer can grow */
+    frame = &recorder->slots[tail & (RECORDER_SLOTS - 1)];
+    if (frame->capacity < n_pixels)
+    {
+        free(frame->pixels);
+        if ((frame->pixels = malloc(n_pixels * 4)) == NULL)
+        {
+            printf("Malloc error.\n");
+            exit(EXIT_FAILURE);
+        }
+        frame->capacity = n_pixels;
+    }
+    memcpy(frame->pixels, pixels, n_pixels * 4);
+    frame->number = number;
+    frame->width = fb->width;
+    frame->height = fb->height;
+    recorder->captured++;
+    atomic_store_explicit(&recorder->tail, tail + 1, memory_order_release);
+}
+
+static uint8_t *recorder_conversion(struct recorder_t *recorder, size_t size)
+{
+    if (recorder->conversion_size < size)
+    {
+        free(recorder->conversion);
+        if ((recorder->conversion = malloc(size)) == NULL)
+        {
+            printf("Malloc error.\n");
+            exit(EXIT_FAILURE);
+        }
+        recorder->conversion_size = size;
+    }
+
+    return recorder->conversion;
+}
+
+/**
+ * Y'CbCr 4:4:4 planes, BT.601 limited range.
+ */
+static int recorder_write_y4m(struct recorder_t *recorder, const struct recorder_frame_t *frame)
+{
+    size_t n = (size_t)frame->width * frame->height;
+    uint8_t *y = recorder_conversion(recorder, 3 * n);
+    uint8_t *u = y + n;
+    uint8_t *v = u + n;
+    int r, g, b;
+    size_t i;
+
+    if (recorder->y4m_width == 0)
+    {
+        recorder->y4m_width = frame->width;
+        recorder->y4m_height = frame->height;
+        if (fprintf(recorder->file, "YUV4MPEG2 W%u H%u F%d:1 Ip A1:1 C444\n", frame->width, frame->height,
+                    RECORDER_Y4M_FPS) < 0)
+            return -1;
+    }
+    else if (frame->width != recorder->y4m_width || frame->height != recorder->y4m_height)
+    {
+        /* A Y4M stream has a single size */
+        recorder->skipped++;
+        return 0;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        r = (frame->pixels[i] >> 16) & 0xFF;
+        g = (frame->pixels[i] >> 8) & 0xFF;
+        b = frame->pixels[i] & 0xFF;
+        y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+
+    if (fputs("FRAME\n", recorder->file) == EOF || fwrite(y, 1, 3 * n, recorder->file) != 3 * n)
+        return -1;
+
+    return 0;
+}
+
+static int recorder_write_ppm(struct recorder_t *recorder, const struct recorder_frame_t *frame)
+{
+    size_t n = (size_t)frame->width * frame->height;
+    uint8_t *rgb = recorder_conversion(recorder, 3 * n);
+    char *name;
+    FILE *fp;
+    size_t i;
+    int error;
+
+    for (i = 0; i < n; i++)
+    {
+        rgb[3 * i] = frame->pixels[i] >> 16;
+        rgb[3 * i + 1] = frame->pixels[i] >> 8;
+        rgb[3 * i + 2] = frame->pixels[i];
+    }
+
+    if ((name = malloc(strlen(recorder->file_name) + 32)) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(name, "%s%06" PRIu64 ".ppm", recorder->file_name, frame->number);
+    fp = fopen(name, "wb");
+    free(name);
+    if (fp == NULL)
+        return -1;
+    error = fprintf(fp, "P6\n%u %u\n255\n", frame->width, frame->height) < 0 || fwrite(rgb, 1, 3 * n, fp) != 3 * n;
+    if (fclose(fp) != 0 || error)
+        return -1;
+
+    return 0;
+}
+
+static int recorder_write_rgba(struct recorder_t *recorder, const struct recorder_frame_t *frame)
+{
+    size_t n = (size_t)frame->width * frame->height;
+    uint8_t *rgba = recorder_conversion(recorder, 4 * n);
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        rgba[4 * i] = frame->pixels[i] >> 16;
+        rgba[4 * i + 1] = frame->pixels[i] >> 8;
+        rgba[4 * i + 2] = frame->pixels[i];
+        rgba[4 * i + 3] = 0xFF;
+    }
+
+    return fwrite(rgba, 1, 4 * n, recorder->file) == 4 * n ? 0 : -1;
+}
+
+/**
+ * I/O thread sink: convert and write the oldest frame of the ring.
+ */
+static int recorder_drain(void *opaque)
+{
+    struct recorder_t *recorder = opaque;
+    struct recorder_frame_t *frame;
+    uint32_t head;
+    int status = 0;
+
+    head = atomic_load_explicit(&recorder->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&recorder->tail, memory_order_acquire))
+        return 0;
+
+    frame = &recorder->slots[head & (RECORDER_SLOTS - 1)];
+    if (!recorder->error)
+    {
+        switch (recorder->format)
+        {
+        case RECORDER_Y4M:
+            status = recorder_write_y4m(recorder, frame);
+            break;
+        case RECORDER_PPM:
+            status = recorder_write_ppm(recorder, frame);
+            break;
+        case RECORDER_RGBA:
+            status = recorder_write_rgba(recorder, frame);
+            break;
+        }
+        if (status == -1)
+            recorder->error = 1;
+        else
+            recorder->written++;
+    }
+    atomic_store_explicit(&recorder->head, head + 1, memory_order_release);
+
+    return 1;
+}
+
+struct recorder_t *recorder_open(struct framebuffer_t *fb, const char *file_name, enum recorder_format_t format,
+                                 uint32_t every)
+{
+    struct recorder_t *recorder;
+
+    if ((recorder = calloc(1, sizeof(struct recorder_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    recorder->fb = fb;
+    recorder->format = format;
+    recorder->every = every;
+    recorder->file_name = file_name;
+
+    if (format != RECORDER_PPM && (recorder->file = fopen(file_name, "wb")) == NULL)
+    {
+        perror("Error while opening the recording file");
+        free(recorder);
+        return NULL;
+    }
+
+    iothread_add_sink(fb->platform->io, recorder_drain, recorder);
+    framebuffer_set_listener(fb, recorder_capture, recorder);
+
+    return recorder;
+}
+
+int recorder_close(struct recorder_t *recorder)
+{
+    int status = 0;
+    int i;
+
+    framebuffer_set_listener(recorder->fb, NULL, NULL);
+    iothread_remove_sink(recorder->fb->platform->io, recorder);
+
+    if ((recorder->file != NULL && fclose(recorder->file) != 0) || recorder->error)
+    {
+        printf("Error while writing the recording.\n");
+        status = -1;
+    }
+
+    for (i = 0; i < RECORDER_SLOTS; i++)
+        free(recorder->slots[i].pixels);
+    free(recorder->conversion);
+    free(recorder);
+
+    return status;
+}
@@ -0,0 +1,76 @@
+#include <stdio.h>
+
+#include "minirisc.h"
+#include "platform.h"
+#include "stats.h"
+#include "framebuffer.h"
+#include "dma.h"
+#include "hle.h"
+
+static double stats_mips(struct minirisc_t *minirisc, double seconds)
+{
+    return seconds > 0 ? (minirisc->instret - minirisc->stats.start_instret) / seconds / 1e6 : 0;
+}
+
+static double stats_fps(struct minirisc_t *minirisc, double seconds)
+{
+    return seconds > 0 ? minirisc->platform->framebuffer->frames / seconds : 0;
+}
+
+void stats_print(struct minirisc_t *minirisc, double seconds)
+{
+    printf("Instructions retired : %" PRIu64 "\n", minirisc->instret);
+    printf("Wall time            : %.3f s\n", seconds);
+    printf("MIPS                 : %.1f\n", stats_mips(minirisc, seconds));
+    if (minirisc->platform->framebuffer->frames)
+        printf("Frames               : %" PRIu64 " (%.1f fps)\n", minirisc->platform->framebuffer->frames,
+               stats_fps(minirisc, seconds));
+    if (minirisc->platform->dma->transfers)
+        printf("DMA transfers        : %" PRIu64 " (%" PRIu64 " bytes)\n", minirisc->platform->dma->transfers,
+               minirisc->platform->dma->bytes);
+    if (minirisc->hle && minirisc->hle->mode == HLE_NATIVE)
+        printf("HLE calls            : %" PRIu64 " (%" PRIu64 " left to the guest)\n", hle_calls(minirisc->hle),
+               minirisc->hle->declined);
+    if (minirisc->hle && minirisc->hle->mode == HLE_CHECK)
+        printf("HLE checks           : %" PRIu64 " (%" PRIu64 " left to the guest)\n", minirisc->hle->checked,
+               minirisc->hle->declined);
+#ifdef MINIRISC_STATS
+    printf("Loads                : %" PRIu64 "\n", minirisc->stats.loads);
+    printf("Stores               : %" PRIu64 "\n", minirisc->stats.stores);
+    printf("Branches taken       : %" PRIu64 "\n", minirisc->stats.branches_taken);
+    printf("Branches not taken   : %" PRIu64 "\n", minirisc->stats.branches_not_taken);
+    printf("MMIO accesses        : %" PRIu64 "\n", minirisc->platform->mmio_accesses);
+#endif
+}
+
+int stats_write_json(struct minirisc_t *minirisc, double seconds, const char *file_name)
+{
+    FILE *fp = fopen(file_name, "w");
+
+    if (fp == NULL)
+    {
+        perror("Error while opening the stats file");
+        return -1;
+    }
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"instructions\": %" PRIu64 ",\n", minirisc->instret);
+    fprintf(fp, "  \"wall_time_s\": %.6f,\n", seconds);
+    fprintf(fp, "  \"frames\": %" PRIu64 ",\n", minirisc->platform->framebuffer->frames);
+    fprintf(fp, "  \"fps\": %.3f,\n", stats_fps(minirisc, seconds));
+    fprintf(fp, "  \"dma_transfers\": %" PRIu64 ",\n", minirisc->platform->dma->transfers);
+    fprintf(fp, "  \"dma_bytes\": %" PRIu64 ",\n", minirisc->platform->dma->bytes);
+    fprintf(fp, "  \"hle_calls\": %" PRIu64 ",\n", minirisc->hle ? hle_calls(minirisc->hle) : 0);
+    fprintf(fp, "  \"hle_checks\": %" PRIu64 ",\n", minirisc->hle ? minirisc->hle->checked : 0);
+#ifdef MINIRISC_STATS
+    fprintf(fp, "  \"loads\": %" PRIu64 ",\n", minirisc->stats.loads);
+    fprintf(fp, "  \"stores\": %" PRIu64 ",\n", minirisc->stats.stores);
+    fprintf(fp, "  \"branches_taken\": %" PRIu64 ",\n", minirisc->stats.branches_taken);
+    fprintf(fp, "  \"branches_not_taken\": %" PRIu64 ",\n", minirisc->stats.branches_not_taken);
+    fprintf(fp, "  \"mmio_accesses\": %" PRIu64 ",\n", minirisc->platform->mmio_accesses);
+#endif
+    fprintf(fp, "  \"mips\": %.3f\n", stats_mips(minirisc, seconds));
+    fprintf(fp, "}\n");
+
+    return fclose(fp) == 0 ? 0 : -1;
+}
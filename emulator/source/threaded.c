@@ -0,0 +1,35 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "types.h"
+#include "minirisc.h"
+#include "platform.h"
+#include "icache.h"
+#include "threaded.h"
+
+/*
+ * The dispatch loop is written once in threaded_loop.inc and instantiated
+ * twice: with a switch, and with computed gotos when the compiler supports
+ * labels-as-values (GCC, Clang).
+ */
+
+#define THREADED_RUN threaded_run_switch
+#include "threaded_loop.inc"
+#undef THREADED_RUN
+
+#if defined(__GNUC__)
+
+#define THREADED_GOTO
+#define THREADED_RUN threaded_run
+#include "threaded_loop.inc"
+#undef THREADED_RUN
+#undef THREADED_GOTO
+
+#else
+
+void threaded_run(struct minirisc_t *minirisc)
+{
+    threaded_run_switch(minirisc);
+}
+
+#endif
@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#ifdef MINIRISC_ZLIB
+#include <zlib.h>
+#endif
+
+#include "trace.h"
+#include "iothread.h"
+
+static int trace_ring_push(struct trace_ring_t *ring, struct trace_buffer_t *buffer)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == TRACE_BUFFERS)
+        return -1;
+    ring->slots[tail & (TRACE_BUFFERS - 1)] = buffer;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    return 0;
+}
+
+static struct trace_buffer_t *trace_ring_pop(struct trace_ring_t *ring)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct trace_buffer_t *buffer;
+
+    if (head == atomic_load_explicit(&ring->tail, memory_order_acquire))
+        return NULL;
+    buffer = ring->slots[head & (TRACE_BUFFERS - 1)];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    return buffer;
+}
+
+static int trace_file_write(void *file, const void *data, uint32_t size)
+{
+#ifdef MINIRISC_ZLIB
+    return gzwrite(file, data, size) == (int)size ? 0 : -1;
+#else
+    return fwrite(data, 1, size, file) == size ? 0 : -1;
+#endif
+}
+
+/**
+ * I/O thread sink: compress and write the next full buffer.
+ */
+static int trace_drain(void *opaque)
+{
+    struct trace_t *trace = opaque;
+    struct trace_buffer_t *buffer;
+
+    if ((buffer = trace_ring_pop(&trace->full)) == NULL)
+        return 0;
+    if (!trace->error && trace_file_write(trace->file, buffer->data, buffer->used) == -1)
+        trace->error = 1;
+    trace_ring_push(&trace->free, buffer);
+
+    return 1;
+}
+
+static struct trace_buffer_t *trace_buffer_new()
+{
+    struct trace_buffer_t *buffer;
+
+    if ((buffer = malloc(sizeof(struct trace_buffer_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return buffer;
+}
+
+static void trace_start_buffer(struct trace_t *trace, struct trace_buffer_t *buffer)
+{
+    trace->buffer = buffer;
+    trace->p = buffer->data;
+    trace->end = buffer->data + TRACE_BUFFER_SIZE - TRACE_MAX_EVENT;
+}
+
+struct trace_t *trace_open(const char *file_name, uint32_t entry, struct iothread_t *io)
+{
+    struct trace_t *trace;
+
+    if ((trace = calloc(1, sizeof(struct trace_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+#ifdef MINIRISC_ZLIB
+    trace->file = gzopen(file_name, "wb1"); /* Fastest level: the writer has to keep up */
+#else
+    trace->file = fopen(file_name, "wb");
+#endif
+    if (trace->file == NULL)
+    {
+        perror("Error while opening the trace file");
+        free(trace);
+        return NULL;
+    }
+
+    trace_start_buffer(trace, trace_buffer_new());
+    trace->n_buffers = 1;
+    memcpy(trace->p, TRACE_MAGIC, 8);
+    memcpy(trace->p + 8, &entry, 4);
+    memset(trace->p + 12, 0, 4);
+    trace->p += TRACE_HEADER_SIZE;
+    trace->next_pc = entry;
+    trace->io = io;
+    iothread_add_sink(io, trace_drain, trace);
+
+    return trace;
+}
+
+void trace_submit(struct trace_t *trace)
+{
+    struct trace_buffer_t *buffer;
+
+    trace->buffer->used = trace->p - trace->buffer->data;
+    while (trace_ring_push(&trace->full, trace->buffer) == -1)
+        sched_yield();
+
+    /* Allocate up to TRACE_BUFFERS buffers, then wait for the writer to give one back */
+    while ((buffer = trace_ring_pop(&trace->free)) == NULL)
+    {
+        if (trace->n_buffers < TRACE_BUFFERS)
+        {
+            buffer = trace_buffer_new();
+            trace->n_buffers++;
+            break;
+        }
+        sched_yield();
+    }
+    trace_start_buffer(trace, buffer);
+}
+
+int trace_close(struct trace_t *trace)
+{
+    struct trace_buffer_t *buffer;
+    int status;
+
+    trace_flush_run(trace);
+    trace->buffer->used = trace->p - trace->buffer->data;
+    while (trace_ring_push(&trace->full, trace->buffer) == -1)
+        sched_yield();
+    iothread_remove_sink(trace->io, trace);
+
+#ifdef MINIRISC_ZLIB
+    status = gzclose(trace->file) == Z_OK ? 0 : -1;
+#else
+    status = fclose(trace->file) == 0 ? 0 : -1;
+#endif
+    if (trace->error || status == -1)
+    {
+        printf("Error while writing the trace file.\n");
+        status = -1;
+    }
+
+    while ((buffer = trace_ring_pop(&trace->free)) != NULL)
+        free(buffer);
+    free(trace);
+
+    return status;
+}
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "types.h"
+#include "platform.h"
+#include "minirisc.h"
+#include "vmctl.h"
+#include "iothread.h"
+
+static int vmctl_read(void *opaque, uint32_t offset, enum access_type_t access_type, uint32_t *data)
+{
+    struct vmctl_t *vmctl = opaque;
+
+    if (access_type != ACCESS_WORD)
+        return -1;
+
+    switch (offset)
+    {
+    case VMCTL_MARKER:
+        *data = vmctl->marker;
+        break;
+    case VMCTL_VM_ID:
+        *data = vmctl->vm_id;
+        break;
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+static int vmctl_write(void *opaque, uint32_t offset, enum access_type_t access_type, uint32_t data)
+{
+    struct vmctl_t *vmctl = opaque;
+
+    if (access_type != ACCESS_WORD || offset != VMCTL_MARKER)
+        return -1;
+
+    vmctl->marker = data;
+    if (vmctl->stop_at_marker)
+    {
+        /* Every engine leaves after the store, with PC on the next instruction */
+        vmctl->minirisc->halt = 1;
+        vmctl->marker_hit = 1;
+    }
+
+    return 0;
+}
+
+struct vmctl_t *vmctl_new(struct minirisc_t *minirisc)
+{
+    struct vmctl_t *vmctl;
+
+    if ((vmctl = calloc(1, sizeof(struct vmctl_t))) == NULL)
+    {
+        printf("Malloc error.\n");
+        exit(EXIT_FAILURE);
+    }
+    vmctl->minirisc = minirisc;
+    platform_add_device(minirisc->platform, "vmctl", VMCTL_BASE, VMCTL_SIZE, vmctl_read, vmctl_write, vmctl);
+
+    return vmctl;
+}
+
+void vmctl_free(struct vmctl_t *vmctl)
+{
+    free(vmctl);
+}
+
+int vmctl_take_marker(struct vmctl_t *vmctl)
+{
+    if (!vmctl->marker_hit)
+        return 0;
+
+    vmctl->marker_hit = 0;
+    vmctl->minirisc->halt = 0;
+
+    return 1;
+}
+
+int vm_fork(struct vmctl_t *vmctl, uint32_t n, pid_t *pids)
+{
+    struct iothread_t *io = vmctl->minirisc->platform->io;
+    uint32_t i, j;
+
+    /* Buffered output would be written once per child, and threads do not survive fork() */
+    iothread_stop(io);
+    fflush(stdout);
+    fflush(stderr);
+
+    for (i = 0; i < n; i++)
+    {
+        if ((pids[i] = fork()) == -1)
+        {
+            perror("Error while forking the VM");
+            /* Do not leave the copies already started running without a parent to wait for them */
+            for (j = 0; j < i; j++)
+            {
+                kill(pids[j], SIGKILL);
+                waitpid(pids[j], NULL, 0);
+            }
+            exit(EXIT_FAILURE);
+        }
+        if (pids[i] == 0)
+        {
+            vmctl->vm_id = i;
+            iothread_start(io);
+            return i;
+        }
+    }
+    iothread_start(io);
+
+    return -1;
+}
+
+void vm_wait(const pid_t *pids, uint32_t n, int *statuses)
+{
+    uint32_t i;
+    int status;
+
+    for (i = 0; i < n; i++)
+    {
+        if (waitpid(pids[i], &status, 0) == -1)
+            statuses[i] = EXIT_FAILURE;
+        else if (WIFSIGNALED(status))
+            statuses[i] = 128 + WTERMSIG(status);
+        else
+            statuses[i] = WEXITSTATUS(status);
+    }
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef MINIRISC_ZLIB
+#include <zlib.h>
+#endif
+
+#include "trace.h"
+
+/**
+ * Decode a trace written by the emulator's --trace option.
+ * Prints one line per instruction (its PC) followed by its memory
+ * accesses, or only the totals with -s.
+ */
+
+#ifdef MINIRISC_ZLIB
+typedef gzFile trace_file_t; /* gzread also reads uncompressed files */
+#define trace_file_open(name) gzopen(name, "rb")
+#define trace_file_read(file, buf, size) gzread(file, buf, size)
+#define trace_file_close(file) gzclose(file)
+#else
+typedef FILE *trace_file_t;
+#define trace_file_open(name) fopen(name, "rb")
+#define trace_file_read(file, buf, size) (int)fread(buf, 1, size, file)
+#define trace_file_close(file) fclose(file)
+#endif
+
+struct reader_t
+{
+    trace_file_t file;
+    uint8_t buffer[1 << 16];
+    int pos;
+    int size;
+};
+
+static int reader_byte(struct reader_t *reader)
+{
+    if (reader->pos == reader->size)
+    {
+        if ((reader->size = trace_file_read(reader->file, reader->buffer, sizeof(reader->buffer))) <= 0)
+            return -1;
+        reader->pos = 0;
+    }
+
+    return reader->buffer[reader->pos++];
+}
+
+/**
+ * @return 0 on success, -1 at the end of the trace, -2 on a truncated varint
+ */
+static int reader_varint(struct reader_t *reader, uint64_t *v)
+{
+    int shift = 0;
+    int c;
+
+    *v = 0;
+    if ((c = reader_byte(reader)) == -1)
+        return -1;
+    while (c & 0x80)
+    {
+        *v |= (uint64_t)(c & 0x7F) << shift;
+        shift += 7;
+        if (shift > 63 || (c = reader_byte(reader)) == -1)
+            return -2;
+    }
+    *v |= (uint64_t)c << shift;
+
+    return 0;
+}
+
+static int32_t unzigzag(uint64_t v)
+{
+    return (int32_t)((uint32_t)v >> 1) ^ -(int32_t)(v & 1);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct reader_t reader;
+    uint8_t header[TRACE_HEADER_SIZE];
+    uint64_t insns = 0, jumps = 0, loads = 0, stores = 0;
+    uint32_t pc, addr = 0;
+    int summary = 0;
+    uint64_t v, n;
+    int status;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "s")) != -1)
+    {
+        if (opt != 's')
+        {
+            printf("Usage: %s [-s] trace\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        summary = 1;
+    }
+    if (optind != argc - 1)
+    {
+        printf("Usage: %s [-s] trace\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if ((reader.file = trace_file_open(argv[optind])) == NULL)
+    {
+        perror("Error while opening the trace file");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < TRACE_HEADER_SIZE; i++)
+        header[i] = reader_byte(&reader);
+    if (memcmp(header, TRACE_MAGIC, 8) != 0)
+    {
+        printf("%s is not a MINIRISC trace.\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    memcpy(&pc, header + 8, 4);
+
+    while ((status = reader_varint(&reader, &v)) == 0)
+    {
+        switch (v & 3)
+        {
+        case TRACE_EXEC:
+            n = v >> 2;
+            insns += n;
+            if (summary)
+                pc += 4 * n;
+            else
+                for (; n > 0; n--, pc += 4)
+                    printf("%08x\n", pc);
+            break;
+        case TRACE_JUMP:
+            jumps++;
+            pc += unzigzag(v >> 2);
+            break;
+        case TRACE_LOAD:
+        case TRACE_STORE:
+            addr += unzigzag(v >> 4);
+            if ((v & 3) == TRACE_LOAD)
+                loads++;
+            else
+                stores++;
+            if (!summary)
+                printf("    %s %08x %d\n", (v & 3) == TRACE_LOAD ? "load " : "store", addr, 1 << ((v >> 2) & 3));
+            break;
+        }
+    }
+    trace_file_close(reader.file);
+
+    if (summary)
+        printf("instructions %" PRIu64 "\njumps        %" PRIu64 "\nloads        %" PRIu64 "\nstores       %" PRIu64 "\n",
+               insns, jumps, loads, stores);
+    if (status == -2)
+    {
+        printf("Truncated trace.\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,73 @@
+#!/bin/sh
+# -------------------------------------------------------------------
+#  Compare the execution engines of the emulator.
+#
+#  Usage (from the repository root):
+#      sh tests/bench.sh [engine...]
+#
+#  Engines default to "interp switch threaded block jit".
+#  Test programs (tests/test_*/build/esw.elf) run to completion and
+#  are timed, best of $RUNS runs. Doom never stops: it runs for
+#  $DOOM_INSTRUCTIONS instructions and the frame rate is taken from
+#  the framebuffer counter (DG_DrawFrame rings FB_DOORBELL), written
+#  by --stats-json.
+#
+#  Build the emulator with optimizations for meaningful numbers:
+#      make clean && make OPTIM=-O2 && sh tests/bench.sh
+# -------------------------------------------------------------------
+
+EMULATOR=${EMULATOR:-./emulator/build/emulator}
+RUNS=${RUNS:-5}
+DOOM_INSTRUCTIONS=${DOOM_INSTRUCTIONS:-2000000000}
+DOOM_BIN=${DOOM_BIN:-embedded_software_doom/build/esw.elf}
+ENGINES=${*:-interp switch threaded block jit}
+
+if [ ! -x "$EMULATOR" ]; then
+    echo "Emulator not found: $EMULATOR (run make first)"
+    exit 1
+fi
+
+now_ns()
+{
+    date +%s%N
+}
+
+printf "%-40s" "program"
+for engine in $ENGINES; do
+    printf "%12s" "$engine"
+done
+printf "\n"
+
+for bin in tests/test_*/build/esw.elf embedded_software/build/esw.elf; do
+    [ -f "$bin" ] || continue
+    printf "%-40s" "$bin (ms)"
+    for engine in $ENGINES; do
+        best=""
+        i=0
+        while [ $i -lt "$RUNS" ]; do
+            start=$(now_ns)
+            "$EMULATOR" -q --engine "$engine" "$bin" > /dev/null 2>&1
+            end=$(now_ns)
+            elapsed=$(( (end - start) / 1000 ))
+            if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then
+                best=$elapsed
+            fi
+            i=$((i + 1))
+        done
+        printf "%12s" "$((best / 1000)).$(( (best % 1000) / 100 ))"
+    done
+    printf "\n"
+done
+
+if [ -f "$DOOM_BIN" ]; then
+    printf "%-40s" "$DOOM_BIN (fps)"
+    json=$(mktemp)
+    for engine in $ENGINES; do
+        : > "$json"
+        "$EMULATOR" -q --engine "$engine" -n "$DOOM_INSTRUCTIONS" --stats-json "$json" "$DOOM_BIN" > /dev/null 2>&1
+        fps=$(sed -n 's/.*"fps": \([0-9.]*\).*/\1/p' "$json")
+        printf "%12s" "${fps:-?}"
+    done
+    rm -f "$json"
+    printf "\n"
+fi